@@ -19,6 +19,21 @@ class HrcLibraryException : public Exception
   }
 };
 
+/** Statistics of compiled regular expressions, shared by equal patterns.
+    @ingroup colorer
+*/
+struct RegExpCacheStats
+{
+  /// count of compiled regular expressions
+  size_t compiled = 0;
+  /// count of patterns, which reused already compiled regular expression
+  size_t hits = 0;
+  /// estimated memory, which is not allocated due to reused regular expressions
+  size_t bytesSaved = 0;
+  /// count of regular expressions, which are kept for reuse
+  size_t cached = 0;
+};
+
 /** Abstract template of HrcLibrary class implementation.
     Defines basic operations of loading and accessing
     HRC information.
@@ -74,6 +89,10 @@ class HrcLibrary
   */
   const Region* getRegion(const UnicodeString* name);
 
+  /** Returns statistics of compiled regular expressions of loaded schemes
+   */
+  RegExpCacheStats getRegExpCacheStats() const;
+
  private:
   class Impl;
 
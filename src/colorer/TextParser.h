@@ -1,11 +1,38 @@
 #ifndef _COLORER_TEXTPARSER_H_
 #define _COLORER_TEXTPARSER_H_
 
+#include <chrono>
+#include <iosfwd>
 #include "colorer/FileType.h"
 #include "colorer/LineSource.h"
 #include "colorer/RegionHandler.h"
 #include "colorer/common/spimpl.h"
 
+/** Statistics of the memo of parsed lines.
+    @ingroup colorer
+*/
+struct LineMemoStats
+{
+  /// count of lines, which regions are replayed from the memo
+  size_t hits = 0;
+  /// count of lines, which are not found in the memo and are parsed
+  size_t misses = 0;
+  /// count of lines in the memo
+  size_t size = 0;
+};
+
+/** Limits of the work, done by one TextParser::parse() call.
+    The limits are checked at the start of each line, after the first line of the call.
+    @ingroup colorer
+*/
+struct ParseBudget
+{
+  /// maximum number of lines to parse, 0 - no limit
+  int lines = 0;
+  /// time, after which the parse stops at the start of the next line
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
 /**
  * Basic lexical/syntax parser interface.
  * This class provides interface to lexical text parsing abilities of
@@ -44,7 +71,14 @@ class TextParser
      * it during parse process.
      * Also causes all cached data from starting parse position to be dropped.
      */
-    TPM_CACHE_UPDATE
+    TPM_CACHE_UPDATE,
+    /**
+     * Works like TPM_CACHE_UPDATE for the text, which grows at the end.
+     * Parser keeps its state after the last parsed line, and the next
+     * TPM_CACHE_APPEND parse from the following line continues with this state,
+     * without the cache search. Any other parse drops the kept state.
+     */
+    TPM_CACHE_APPEND
   };
 
   TextParser();
@@ -78,6 +112,47 @@ class TextParser
    */
   int parse(int from, int num, TextParseMode mode);
 
+  /**
+   * Performs text parse, which stops at the start of a line, when the budget is spent.
+   * Parser keeps its state and the cache is valid for the parsed lines.
+   * The next parse with the same mode from the returned line continues with the kept state.
+   * Any other parse drops the kept state.
+   * @param from  Line to start parsing
+   * @param num   Number of lines to parse
+   * @param mode  Parsing mode.
+   * @param budget Limits of the parse.
+   * @return First line, which is not parsed, or from + num, when all lines are parsed.
+   */
+  int parse(int from, int num, TextParseMode mode, const ParseBudget& budget);
+
+  /**
+   * Reparses the text after modification of lines, which keeps the number of lines.
+   * Works like TPM_CACHE_UPDATE parse, but stops at the first line after the modified ones,
+   * where the parser state is the same, as it was cached before the modification.
+   * The cache and regions of the following lines stay valid.
+   * @param from  First modified line, parsing starts from it
+   * @param to    Last modified line
+   * @param num   Maximum number of lines to parse
+   * @param damagedEnd Receives the last line, which regions could be changed
+   * @return Last line, which is covered by the valid cache
+   */
+  int reparseLines(int from, int to, int num, int* damagedEnd);
+
+  /**
+   * Performs TPM_CACHE_OFF parse, which splits the lines into chunks and parses them
+   * on several threads. Each chunk is parsed from the base scheme of the text.
+   * The chunks are checked in order, and lines of the chunk, which starts in other
+   * parser state, are parsed again, until the state becomes the same.
+   * Regions are passed into the region handler from the calling thread in the order of lines,
+   * as the single parse passes them. Line source should allow concurrent getLine() calls.
+   * @param from  Line to start parsing
+   * @param num   Number of lines to parse
+   * @param threads Number of threads, which parse the chunks.
+   *        The text, which is too short for two chunks, is parsed in the calling thread.
+   * @return Last parsed line.
+   */
+  int parseParallel(int from, int num, int threads);
+
   /**
    * Performs break of parsing process from external thread.
    * It is used to stop parse from external source. This is required
@@ -90,7 +165,44 @@ class TextParser
    * Clears internal cached text tree stucture
    */
   void clearCache();
+
+  /**
+   * Writes the cached text tree structure, which is built by TPM_CACHE_UPDATE parses,
+   * into the binary stream. The stream keeps hashes of the parsed text lines
+   * and of the schemes, used by the file type.
+   * @return false, if the cache could not be written.
+   */
+  bool saveCache(std::ostream& out);
+
+  /**
+   * Reads the cached text tree structure, written by saveCache.
+   * The cache is read only if the text lines and schemes are the same,
+   * as they were, when the cache was written.
+   * @return Number of lines, covered by the read cache, or 0 if the cache is not read.
+   *         Lines after them should be parsed with TPM_CACHE_UPDATE mode.
+   */
+  int loadCache(std::istream& in);
   void setMaxBlockSize(int max_block_size);
+  /**
+   * Sets the number of lines between the cached positions,
+   * where the parse could be started without the search in the whole cache.
+   * @param lines Number of lines, 0 disables the positions.
+   */
+  void setCheckpointInterval(int lines);
+  /**
+   * Sets the number of lines, which regions are kept in the memo.
+   * The line, parsed again in the same parser state, gets regions from the memo
+   * without the search of scheme nodes. Least recently used lines are removed first.
+   * @param lines Number of lines, 0 disables the memo.
+   */
+  void setLineMemoSize(size_t lines);
+  /**
+   * Sets, whether the positions, where no scheme node could start, are skipped without the search.
+   * The regions are the same in both cases.
+   * @param skip Skip the positions, enabled by default.
+   */
+  void setSkipNoMatch(bool skip);
+  [[nodiscard]] LineMemoStats getLineMemoStats() const;
 
   ~TextParser() = default;
 
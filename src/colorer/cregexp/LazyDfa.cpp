@@ -0,0 +1,601 @@
+#include "colorer/cregexp/LazyDfa.h"
+#ifdef COLORER_FEATURE_ICU
+#include "unicode/uchar.h"
+#endif
+
+// flags of DFA state: properties of the previous character
+#define DFA_PREV_WORD 0x01
+#define DFA_PREV_LETTER 0x02
+#define DFA_PREV_NEWLINE 0x04
+// state is at the start of the string
+#define DFA_ZERO_POS 0x08
+
+static bool isZeroWidthMeta(EMetaSymbols symb)
+{
+  switch (symb) {
+    case EMetaSymbols::ReSoL:
+    case EMetaSymbols::ReEoL:
+    case EMetaSymbols::ReWBound:
+    case EMetaSymbols::ReNWBound:
+    case EMetaSymbols::RePreNW:
+#ifdef COLORERMODE
+    case EMetaSymbols::ReSoScheme:
+    case EMetaSymbols::ReStart:
+    case EMetaSymbols::ReEnd:
+#endif
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool isNewLine(UChar c)
+{
+  return c == 0x0A || c == 0x0B || c == 0x0C || c == 0x0D || c == 0x85 || c == 0x2028 || c == 0x2029;
+}
+
+static bool isRepeat(EOps op)
+{
+  return op == EOps::ReRangeN || op == EOps::ReRangeNM || op == EOps::ReNGRangeN || op == EOps::ReNGRangeNM;
+}
+
+/** Could the sequence of nodes match empty string.
+*/
+static bool isNullable(const SRegInfo* re)
+{
+  for (; re; re = re->next) {
+    switch (re->op) {
+      case EOps::ReOr:
+        return isNullable(re->un.param) || isNullable(re->next);
+      case EOps::ReEmpty:
+        break;
+      case EOps::ReMetaSymb:
+        if (!isZeroWidthMeta(re->un.metaSymbol))
+          return false;
+        break;
+      case EOps::ReBrackets:
+      case EOps::ReNamedBrackets:
+        if (!isNullable(re->un.param))
+          return false;
+        break;
+      case EOps::ReRangeN:
+      case EOps::ReRangeNM:
+      case EOps::ReNGRangeN:
+      case EOps::ReNGRangeNM:
+        if (re->s > 0 && !isNullable(re->un.param))
+          return false;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+/** Does the sequence of nodes make backtracking points.
+*/
+static bool hasChoice(const SRegInfo* re)
+{
+  for (; re; re = re->next) {
+    if (re->op == EOps::ReOr || isRepeat(re->op))
+      return true;
+    if ((re->op == EOps::ReBrackets || re->op == EOps::ReNamedBrackets) && hasChoice(re->un.param))
+      return true;
+  }
+  return false;
+}
+
+static inline int encodeTransition(int state, bool matched)
+{
+  return (state + 1) << 1 | (matched ? 1 : 0);
+}
+
+LazyDfa::LazyDfa(bool ignoreCase_, bool singleLine_, bool multiLine_)
+    : ignoreCase(ignoreCase_), singleLine(singleLine_), multiLine(multiLine_)
+{
+  // class of the end of line
+  classes.push_back({0, 0});
+  // dead state without threads
+  std::vector<int> none;
+  addState(none, 0);
+}
+
+LazyDfa::~LazyDfa() = default;
+
+size_t LazyDfa::getProgramSize() const
+{
+  return sizeof(LazyDfa) + program.capacity() * sizeof(Inst) + tests.capacity() * sizeof(Test);
+}
+
+std::unique_ptr<LazyDfa> LazyDfa::create(const SRegInfo* root, bool ignoreCase, bool singleLine,
+                                         bool multiLine)
+{
+  std::unique_ptr<LazyDfa> dfa(new LazyDfa(ignoreCase, singleLine, multiLine));
+  if (!dfa->isRegular(root, false))
+    return nullptr;
+  const int match = dfa->emitInst(EInst::MATCH, 0);
+  dfa->startInst = dfa->emitNode(root, match);
+  if (dfa->tooLarge)
+    return nullptr;
+  dfa->marks.resize(dfa->program.size());
+  return dfa;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// NFA program
+
+bool LazyDfa::isRegular(const SRegInfo* re, bool inRepeat) const
+{
+  for (; re; re = re->next) {
+    switch (re->op) {
+      case EOps::ReEmpty:
+      case EOps::ReSymb:
+      case EOps::ReEnum:
+      case EOps::ReNEnum:
+        break;
+      case EOps::ReWord:
+#ifdef COLORER_FEATURE_ICU
+        // case folding of the word gives the same result as folding of its units only for ASCII
+        if (ignoreCase)
+          for (int i = 0; i < re->un.word->length(); i++)
+            if ((*re->un.word)[i] >= 0x80)
+              return false;
+#endif
+        break;
+      case EOps::ReMetaSymb:
+        if (re->un.metaSymbol == EMetaSymbols::ReBadMeta || re->un.metaSymbol >= EMetaSymbols::ReChrLast)
+          return false;
+#ifdef COLORERMODE
+        if (re->un.metaSymbol == EMetaSymbols::ReStart || re->un.metaSymbol == EMetaSymbols::ReEnd)
+          return false;
+#endif
+        break;
+      case EOps::ReOr:
+      case EOps::ReBrackets:
+      case EOps::ReNamedBrackets:
+        if (!isRegular(re->un.param, inRepeat))
+          return false;
+        break;
+      case EOps::ReRangeN:
+      case EOps::ReRangeNM:
+      case EOps::ReNGRangeN:
+      case EOps::ReNGRangeNM:
+        if (re->s < 0 || ((re->op == EOps::ReRangeNM || re->op == EOps::ReNGRangeNM) && re->e < re->s))
+          return false;
+        // lowParse() stops the repeat after the empty iteration
+        if (isNullable(re->un.param))
+          return false;
+        // repeat counters are kept in the node state and are not restored, when the backtracker
+        // returns into the previous iteration, or into the previous iteration of the outer repeat
+        if (hasChoice(re->un.param) && (inRepeat || re->s > 1))
+          return false;
+        if (!isRegular(re->un.param, true))
+          return false;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+int LazyDfa::emitInst(EInst op, int x, int y, int arg)
+{
+  if (program.size() >= DFA_PROGRAM_SIZE) {
+    tooLarge = true;
+    return 0;
+  }
+  program.push_back({op, x, y, arg});
+  return static_cast<int>(program.size()) - 1;
+}
+
+int LazyDfa::addTest(ETest kind, UChar symbol, EMetaSymbols metaSymbol, const CharacterClass* charclass)
+{
+  for (size_t i = 0; i < tests.size(); i++) {
+    const Test& test = tests[i];
+    if (test.kind == kind && test.symbol == symbol && test.metaSymbol == metaSymbol &&
+        test.charclass == charclass)
+      return static_cast<int>(i);
+  }
+  // tests of a class are kept in 64 bit mask
+  if (tests.size() == 64) {
+    tooLarge = true;
+    return 0;
+  }
+  tests.push_back({kind, symbol, metaSymbol, charclass});
+  return static_cast<int>(tests.size()) - 1;
+}
+
+/** Emits instructions of the sequence, which are followed by @c cont instruction.
+    Returns the first instruction of the sequence.
+*/
+int LazyDfa::emitSequence(const SRegInfo* re, int cont)
+{
+  if (!re)
+    return cont;
+  if (re->op == EOps::ReOr) {
+    // operand is the first alternative, the rest of the sequence is the second one
+    const int first = emitSequence(re->un.param, cont);
+    const int second = emitSequence(re->next, cont);
+    return emitInst(EInst::SPLIT, first, second);
+  }
+  return emitNode(re, emitSequence(re->next, cont));
+}
+
+int LazyDfa::emitNode(const SRegInfo* re, int cont)
+{
+  switch (re->op) {
+    case EOps::ReBrackets:
+    case EOps::ReNamedBrackets:
+      return emitSequence(re->un.param, cont);
+    case EOps::ReSymb:
+      return emitInst(EInst::CHAR, cont, 0,
+                      addTest(ignoreCase ? ETest::CASE : ETest::SYMB, re->un.symbol, EMetaSymbols::ReBadMeta,
+                              nullptr));
+    case EOps::ReWord:
+      for (int i = re->un.word->length() - 1; i >= 0; i--)
+        cont = emitInst(EInst::CHAR, cont, 0,
+                        addTest(ignoreCase ? ETest::FOLD : ETest::SYMB, (*re->un.word)[i],
+                                EMetaSymbols::ReBadMeta, nullptr));
+      return cont;
+    case EOps::ReEnum:
+    case EOps::ReNEnum:
+      return emitInst(EInst::CHAR, cont, 0,
+                      addTest(re->op == EOps::ReEnum ? ETest::ENUM : ETest::NENUM, 0, EMetaSymbols::ReBadMeta,
+                              re->un.charclass));
+    case EOps::ReMetaSymb:
+      switch (re->un.metaSymbol) {
+        case EMetaSymbols::ReSoL:
+          usedFlags |= DFA_ZERO_POS | (multiLine ? DFA_PREV_NEWLINE : 0);
+          break;
+        case EMetaSymbols::ReEoL:
+          usedFlags |= multiLine ? DFA_ZERO_POS | DFA_PREV_NEWLINE : 0;
+          break;
+        case EMetaSymbols::ReWBound:
+        case EMetaSymbols::ReNWBound:
+          usedFlags |= DFA_PREV_WORD;
+          break;
+        case EMetaSymbols::RePreNW:
+          usedFlags |= DFA_ZERO_POS | DFA_PREV_LETTER;
+          break;
+#ifdef COLORERMODE
+        case EMetaSymbols::ReSoScheme:
+          usesScheme = true;
+          break;
+#endif
+        default:
+          return emitInst(EInst::CHAR, cont, 0, addTest(ETest::META, 0, re->un.metaSymbol, nullptr));
+      }
+      return emitInst(EInst::ASSERT, cont, 0, static_cast<int>(re->un.metaSymbol));
+    case EOps::ReRangeN:
+    case EOps::ReNGRangeN: {
+      const bool greedy = re->op == EOps::ReRangeN;
+      const int loop = emitInst(EInst::SPLIT, 0, 0);
+      const int body = emitSequence(re->un.param, loop);
+      if (tooLarge)
+        return cont;
+      // greedy repeat tries one more iteration first, non greedy one tries the rest of RE first
+      program[loop].x = greedy ? body : cont;
+      program[loop].y = greedy ? cont : body;
+      int entry = loop;
+      for (int i = 0; i < re->s && !tooLarge; i++) entry = emitSequence(re->un.param, entry);
+      return entry;
+    }
+    case EOps::ReRangeNM:
+    case EOps::ReNGRangeNM: {
+      const bool greedy = re->op == EOps::ReRangeNM;
+      int entry = cont;
+      for (int i = 0; i < re->e - re->s && !tooLarge; i++) {
+        const int body = emitSequence(re->un.param, entry);
+        entry = greedy ? emitInst(EInst::SPLIT, body, cont) : emitInst(EInst::SPLIT, cont, body);
+      }
+      for (int i = 0; i < re->s && !tooLarge; i++) entry = emitSequence(re->un.param, entry);
+      return entry;
+    }
+    default:
+      return cont;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// character classes
+
+/** Tests character as CRegExp::lowParse() does.
+*/
+bool LazyDfa::testChar(const Test& test, UChar c) const
+{
+  switch (test.kind) {
+    case ETest::SYMB:
+      return c == test.symbol;
+    case ETest::CASE:
+      return Character::toLowerCase(c) == Character::toLowerCase(test.symbol) ||
+          Character::toUpperCase(c) == Character::toUpperCase(test.symbol);
+    case ETest::FOLD:
+      return Character::foldCase(c) == Character::foldCase(test.symbol);
+    case ETest::ENUM:
+      return test.charclass->contains(c);
+    case ETest::NENUM:
+      return !test.charclass->contains(c);
+    case ETest::META:
+      switch (test.metaSymbol) {
+        case EMetaSymbols::ReAnyChr:
+          return singleLine || !isNewLine(c);
+        case EMetaSymbols::ReDigit:
+          return Character::isDigit(c);
+        case EMetaSymbols::ReNDigit:
+          return !Character::isDigit(c);
+        case EMetaSymbols::ReWordSymb:
+          return Character::isLetterOrDigit(c) || c == '_';
+        case EMetaSymbols::ReNWordSymb:
+          return !(Character::isLetterOrDigit(c) || c == '_');
+        case EMetaSymbols::ReWSpace:
+          return Character::isWhitespace(c);
+        case EMetaSymbols::ReNWSpace:
+          return !Character::isWhitespace(c);
+        case EMetaSymbols::ReUCase:
+          return Character::isUpperCase(c);
+        case EMetaSymbols::ReNUCase:
+          return Character::isLowerCase(c);
+        default:
+          return false;
+      }
+  }
+  return false;
+}
+
+/** Builds class map of 256 units, which have the same high byte.
+*/
+const uint8_t* LazyDfa::loadPage(int page) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  const uint8_t* units = pages[page].load(std::memory_order_acquire);
+  if (units || full.load(std::memory_order_relaxed))
+    return units;
+
+  std::unique_ptr<uint8_t[]> map(new uint8_t[256]);
+  for (int i = 0; i < 256; i++) {
+    const auto c = static_cast<UChar>(page << 8 | i);
+    CharClass cls = {0, 0};
+    for (size_t t = 0; t < tests.size(); t++)
+      if (testChar(tests[t], c))
+        cls.tests |= uint64_t(1) << t;
+    if (Character::isLetterOrDigit(c) || c == '_')
+      cls.props |= DFA_PREV_WORD;
+    if (Character::isLetter(c))
+      cls.props |= DFA_PREV_LETTER;
+    if (isNewLine(c))
+      cls.props |= DFA_PREV_NEWLINE;
+    cls.props &= usedFlags;
+
+    // class 0 is the end of line
+    size_t id = 1;
+    while (id < classes.size() && (classes[id].tests != cls.tests || classes[id].props != cls.props)) id++;
+    if (id == classes.size()) {
+      if (id == DFA_CLASSES_NUM) {
+        full = true;
+        return nullptr;
+      }
+      classes.push_back(cls);
+      classProps[id] = cls.props;
+    }
+    map[i] = static_cast<uint8_t>(id);
+  }
+  units = map.get();
+  pageStore.push_back(std::move(map));
+  pages[page].store(units, std::memory_order_release);
+  return units;
+}
+
+inline int LazyDfa::classOf(UChar c) const
+{
+  const uint8_t* units = pages[c >> 8].load(std::memory_order_acquire);
+  if (!units && !(units = loadPage(c >> 8)))
+    return -1;
+  return units[c & 0xFF];
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// DFA states
+
+/** Adds state with the NFA threads and the flags, returns its index or -1, if there is no space.
+    Must be called under the mutex.
+*/
+int LazyDfa::addState(std::vector<int>& threads, uint8_t flags) const
+{
+  // all states without threads are dead
+  if (threads.empty() && !states.empty())
+    return 0;
+  threads.push_back(flags);
+  auto it = stateIds.find(threads);
+  if (it != stateIds.end())
+    return it->second;
+
+  const int id = static_cast<int>(states.size());
+  if (id == DFA_STATES_NUM) {
+    full = true;
+    return -1;
+  }
+  if (id % DFA_ROWS_BLOCK == 0) {
+    std::unique_ptr<StateRow[]> block(new StateRow[DFA_ROWS_BLOCK]());
+    rows[id / DFA_ROWS_BLOCK].store(block.get(), std::memory_order_release);
+    rowStore.push_back(std::move(block));
+  }
+  stateIds.emplace(threads, id);
+  threads.pop_back();
+  states.push_back({threads, flags});
+  return id;
+}
+
+int LazyDfa::startState(uint8_t flags) const
+{
+  const int ready = startStates[flags].load(std::memory_order_acquire);
+  if (ready)
+    return ready - 1;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<int> threads = {startInst};
+  const int state = addState(threads, flags);
+  if (state >= 0)
+    startStates[flags].store(state + 1, std::memory_order_release);
+  return state;
+}
+
+bool LazyDfa::checkAssert(EMetaSymbols metaSymbol, uint8_t flags, uint8_t nextProps, bool atEnd,
+                          bool atScheme) const
+{
+  const bool zero = flags & DFA_ZERO_POS;
+  switch (metaSymbol) {
+    case EMetaSymbols::ReSoL:
+      return zero || (multiLine && (flags & DFA_PREV_NEWLINE));
+    case EMetaSymbols::ReEoL:
+      return atEnd || (multiLine && !zero && (flags & DFA_PREV_NEWLINE));
+    case EMetaSymbols::ReWBound:
+      return ((flags & DFA_PREV_WORD) != 0) != (!atEnd && (nextProps & DFA_PREV_WORD));
+    case EMetaSymbols::ReNWBound:
+      return ((flags & DFA_PREV_WORD) != 0) == (!atEnd && (nextProps & DFA_PREV_WORD));
+    case EMetaSymbols::RePreNW:
+      return atEnd || zero || !(flags & DFA_PREV_LETTER);
+#ifdef COLORERMODE
+    case EMetaSymbols::ReSoScheme:
+      return atScheme;
+#endif
+    default:
+      return false;
+  }
+}
+
+/** Builds transition of the state by the character class.
+    Zero width operators are checked before the character is taken, so the transition
+    tells also, if the match ends before the character.
+    Returns encoded transition, or 0 if DFA is full.
+*/
+int LazyDfa::transition(int state, int cls, bool atScheme) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  StateRow& row = rows[state / DFA_ROWS_BLOCK].load(std::memory_order_relaxed)[state % DFA_ROWS_BLOCK];
+  std::atomic<int>& cached = row.next[cls];
+  if (!atScheme) {
+    const int ready = cached.load(std::memory_order_relaxed);
+    if (ready)
+      return ready;
+  }
+  if (full.load(std::memory_order_relaxed))
+    return 0;
+
+  const uint8_t flags = states[state].flags;
+  const CharClass charClass = classes[cls];
+  const bool atEnd = cls == 0;
+
+  // follows threads in the order of priority, lower priority threads are dropped after the match
+  std::vector<int> chars;
+  std::vector<int> stack;
+  bool matched = false;
+  markGen++;
+  for (const int thread : states[state].threads) {
+    stack.push_back(thread);
+    while (!stack.empty() && !matched) {
+      const int pc = stack.back();
+      stack.pop_back();
+      if (marks[pc] == markGen)
+        continue;
+      marks[pc] = markGen;
+      const Inst& inst = program[pc];
+      switch (inst.op) {
+        case EInst::CHAR:
+          chars.push_back(pc);
+          break;
+        case EInst::SPLIT:
+          stack.push_back(inst.y);
+          stack.push_back(inst.x);
+          break;
+        case EInst::ASSERT:
+          if (checkAssert(static_cast<EMetaSymbols>(inst.arg), flags, charClass.props, atEnd, atScheme))
+            stack.push_back(inst.x);
+          break;
+        case EInst::MATCH:
+          matched = true;
+          break;
+      }
+    }
+    if (matched)
+      break;
+  }
+
+  std::vector<int> threads;
+  if (!atEnd) {
+    markGen++;
+    for (const int pc : chars) {
+      const int next = program[pc].x;
+      if ((charClass.tests >> program[pc].arg & 1) && marks[next] != markGen) {
+        marks[next] = markGen;
+        threads.push_back(next);
+      }
+    }
+  }
+  const int target = addState(threads, charClass.props);
+  if (target < 0)
+    return 0;
+  const int result = encodeTransition(target, matched);
+  if (!atScheme)
+    cached.store(result, std::memory_order_release);
+  return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// matching
+
+template <class Units>
+int LazyDfa::run(const Units& units, int pos, int end, int schemeStart) const
+{
+  uint8_t flags = DFA_ZERO_POS & usedFlags;
+  if (pos > 0) {
+    const int cls = classOf(units[pos - 1]);
+    if (cls < 0)
+      return FAILED;
+    flags = classProps[cls];
+  }
+  int state = startState(flags);
+  if (state < 0)
+    return FAILED;
+
+  int result = NO_MATCH;
+  for (int toParse = pos;; toParse++) {
+    int cls = 0;
+    if (toParse < end) {
+      cls = classOf(units[toParse]);
+      if (cls < 0)
+        return FAILED;
+    }
+    const bool atScheme = usesScheme && toParse == schemeStart;
+    int next = 0;
+    if (!atScheme) {
+      const StateRow& row = rows[state / DFA_ROWS_BLOCK].load(std::memory_order_acquire)[state % DFA_ROWS_BLOCK];
+      next = row.next[cls].load(std::memory_order_acquire);
+    }
+    if (!next) {
+      next = transition(state, cls, atScheme);
+      if (!next)
+        return FAILED;
+    }
+    if (next & 1)
+      result = toParse;
+    state = (next >> 1) - 1;
+    // dead state
+    if (!state)
+      break;
+  }
+  return result;
+}
+
+int LazyDfa::match(const UnicodeString& str, int pos, int end, int schemeStart) const
+{
+  if (full.load(std::memory_order_relaxed))
+    return FAILED;
+#ifdef COLORER_FEATURE_ICU
+  if (end > str.length())
+    return FAILED;
+  return run(str.getBuffer(), pos, end, schemeStart);
+#else
+  return run(str, pos, end, schemeStart);
+#endif
+}
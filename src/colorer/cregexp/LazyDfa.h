@@ -0,0 +1,152 @@
+#ifndef COLORER_LAZYDFA_H
+#define COLORER_LAZYDFA_H
+
+#include "colorer/cregexp/cregexp.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+/// max number of character classes of one DFA, including the end of line class
+#define DFA_CLASSES_NUM 64
+/// max number of DFA states
+#define DFA_STATES_NUM 1024
+/// number of states in one block of transition rows
+#define DFA_ROWS_BLOCK 16
+/// max number of NFA instructions, after counted repeats are unrolled
+#define DFA_PROGRAM_SIZE 4096
+
+/** Lazily built DFA for the regular subset of Colorer REs.
+
+    RE is matched by DFA, if it has no back references, look ahead/behind,
+    \\m \\M operators, and repeats of it could not be changed by the repeat counters,
+    which are not restored by the backtracking matcher (see isRegular()).
+    RE tree is compiled into NFA program, DFA state is the ordered list of NFA threads,
+    so that thread priority follows the order in which CRegExp::lowParse() tries
+    alternatives and repeats. The end of the match is the same as the backtracker gives.
+
+    Input is UTF-16 code units, mapped into classes of units, which are accepted by
+    the same character tests of RE. States and transitions are built on demand.
+    Built part of DFA is shared by all threads and is read without locks,
+    new states are added under the mutex.
+    @ingroup cregexp
+*/
+class LazyDfa
+{
+ public:
+  /// match() result, if RE doesn't match at the position
+  static const int NO_MATCH = -1;
+  /// match() result, if DFA cache is full and RE must be matched by the backtracker
+  static const int FAILED = -2;
+
+  /**
+    Creates DFA for the RE tree, returns nullptr if RE is not regular.
+  */
+  static std::unique_ptr<LazyDfa> create(const SRegInfo* root, bool ignoreCase, bool singleLine,
+                                         bool multiLine);
+  ~LazyDfa();
+
+  /**
+    Matches RE at the position @c pos of string @c str.
+    @return end of the match, NO_MATCH or FAILED.
+  */
+  int match(const UnicodeString& str, int pos, int end, int schemeStart) const;
+
+  /**
+    Returns size of NFA program in bytes, without lazily built states.
+  */
+  size_t getProgramSize() const;
+
+ private:
+  enum class EInst { CHAR, SPLIT, ASSERT, MATCH };
+  // FOLD is used for the words with /i, CASE for the single symbols with /i
+  enum class ETest { SYMB, CASE, FOLD, ENUM, NENUM, META };
+
+  struct Inst
+  {
+    EInst op;
+    // next instruction, preferred one for SPLIT
+    int x;
+    // alternative instruction of SPLIT
+    int y;
+    // test index for CHAR, EMetaSymbols for ASSERT
+    int arg;
+  };
+
+  struct Test
+  {
+    ETest kind;
+    UChar symbol;
+    EMetaSymbols metaSymbol;
+    const CharacterClass* charclass;
+  };
+
+  struct CharClass
+  {
+    // bit per test, which accepts characters of the class
+    uint64_t tests;
+    // properties of the class, used by zero width operators
+    uint8_t props;
+  };
+
+  struct StateRow
+  {
+    // transitions by character classes, 0 if not built yet
+    std::atomic<int> next[DFA_CLASSES_NUM];
+  };
+
+  struct StateInfo
+  {
+    // NFA threads in the order of priority
+    std::vector<int> threads;
+    uint8_t flags;
+  };
+
+  LazyDfa(bool ignoreCase, bool singleLine, bool multiLine);
+
+  bool isRegular(const SRegInfo* re, bool inRepeat) const;
+  int emitSequence(const SRegInfo* re, int cont);
+  int emitNode(const SRegInfo* re, int cont);
+  int emitInst(EInst op, int x, int y = 0, int arg = 0);
+  int addTest(ETest kind, UChar symbol, EMetaSymbols metaSymbol, const CharacterClass* charclass);
+  bool testChar(const Test& test, UChar c) const;
+  bool checkAssert(EMetaSymbols metaSymbol, uint8_t flags, uint8_t nextProps, bool atEnd,
+                   bool atScheme) const;
+
+  template <class Units>
+  int run(const Units& units, int pos, int end, int schemeStart) const;
+  const uint8_t* loadPage(int page) const;
+  int classOf(UChar c) const;
+  int startState(uint8_t flags) const;
+  int transition(int state, int cls, bool atScheme) const;
+  int addState(std::vector<int>& threads, uint8_t flags) const;
+
+  bool ignoreCase;
+  bool singleLine;
+  bool multiLine;
+  bool usesScheme = false;
+  // state flags, which are used by zero width operators of RE
+  uint8_t usedFlags = 0;
+  bool tooLarge = false;
+
+  std::vector<Inst> program;
+  int startInst = 0;
+  std::vector<Test> tests;
+
+  // lazily built part, guarded by mutex
+  mutable std::mutex mutex;
+  mutable std::atomic<bool> full {false};
+  mutable std::atomic<const uint8_t*> pages[256] = {};
+  mutable std::vector<std::unique_ptr<uint8_t[]>> pageStore;
+  mutable std::vector<CharClass> classes;
+  mutable uint8_t classProps[DFA_CLASSES_NUM] = {};
+  mutable std::atomic<int> startStates[16] = {};
+  mutable std::atomic<StateRow*> rows[DFA_STATES_NUM / DFA_ROWS_BLOCK] = {};
+  mutable std::vector<std::unique_ptr<StateRow[]>> rowStore;
+  mutable std::vector<StateInfo> states;
+  mutable std::map<std::vector<int>, int> stateIds;
+  mutable std::vector<int> marks;
+  mutable int markGen = 0;
+};
+
+#endif  // COLORER_LAZYDFA_H
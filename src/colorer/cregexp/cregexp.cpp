@@ -1,8 +1,118 @@
 #include "colorer/cregexp/cregexp.h"
-#include <cstring>
+#include "colorer/cregexp/LazyDfa.h"
+#include <algorithm>
+
+#ifdef COLORER_FEATURE_ICU
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define CREGEXP_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+#if defined(CREGEXP_SSE2) && defined(__GNUC__)
+#define CREGEXP_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#ifdef COLORER_FEATURE_ICU
+/////////////////////////////////////////////////////////////////////////////
+// search of the match start candidates in UTF-16 buffer
+
+/** Returns position of the first unit in [from, to), which is in one of the ranges,
+    or @c to, if there is no such unit.
+*/
+static int scanUnitsScalar(const UChar* buf, int from, int to, const UChar (*ranges)[2], int count)
+{
+  for (; from < to; from++) {
+    const UChar c = buf[from];
+    for (int i = 0; i < count; i++)
+      if (c >= ranges[i][0] && c <= ranges[i][1])
+        return from;
+  }
+  return to;
+}
+
+#ifdef CREGEXP_SSE2
+static inline int lowestBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+static int scanUnitsSSE2(const UChar* buf, int from, int to, const UChar (*ranges)[2], int count)
+{
+  // there is no unsigned 16-bit comparison in SSE2, so units are compared as signed values
+  // shifted by 0x8000
+  const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+  __m128i lo[SCAN_RANGES_NUM];
+  __m128i hi[SCAN_RANGES_NUM];
+  for (int i = 0; i < count; i++) {
+    lo[i] = _mm_set1_epi16(static_cast<short>(ranges[i][0] ^ 0x8000));
+    hi[i] = _mm_set1_epi16(static_cast<short>(ranges[i][1] ^ 0x8000));
+  }
+  for (; from + 8 <= to; from += 8) {
+    const __m128i units =
+        _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + from)), bias);
+    __m128i outside = _mm_set1_epi16(-1);
+    for (int i = 0; i < count; i++)
+      outside = _mm_and_si128(
+          outside, _mm_or_si128(_mm_cmplt_epi16(units, lo[i]), _mm_cmpgt_epi16(units, hi[i])));
+    const unsigned int mask = ~static_cast<unsigned int>(_mm_movemask_epi8(outside)) & 0xFFFFu;
+    if (mask)
+      return from + lowestBit(mask) / 2;
+  }
+  return scanUnitsScalar(buf, from, to, ranges, count);
+}
+#endif
+
+#ifdef CREGEXP_AVX2
+__attribute__((target("avx2"))) static int scanUnitsAVX2(const UChar* buf, int from, int to,
+                                                         const UChar (*ranges)[2], int count)
+{
+  const __m256i bias = _mm256_set1_epi16(static_cast<short>(0x8000));
+  __m256i lo[SCAN_RANGES_NUM];
+  __m256i hi[SCAN_RANGES_NUM];
+  for (int i = 0; i < count; i++) {
+    lo[i] = _mm256_set1_epi16(static_cast<short>(ranges[i][0] ^ 0x8000));
+    hi[i] = _mm256_set1_epi16(static_cast<short>(ranges[i][1] ^ 0x8000));
+  }
+  for (; from + 16 <= to; from += 16) {
+    const __m256i units =
+        _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + from)), bias);
+    __m256i outside = _mm256_set1_epi16(-1);
+    for (int i = 0; i < count; i++)
+      outside = _mm256_and_si256(outside, _mm256_or_si256(_mm256_cmpgt_epi16(lo[i], units),
+                                                          _mm256_cmpgt_epi16(units, hi[i])));
+    const unsigned int mask = ~static_cast<unsigned int>(_mm256_movemask_epi8(outside));
+    if (mask)
+      return from + lowestBit(mask) / 2;
+  }
+  return scanUnitsSSE2(buf, from, to, ranges, count);
+}
+#endif
+
+static int scanUnits(const UChar* buf, int from, int to, const UChar (*ranges)[2], int count)
+{
+#ifdef CREGEXP_AVX2
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2)
+    return scanUnitsAVX2(buf, from, to, ranges, count);
+#endif
+#ifdef CREGEXP_SSE2
+  return scanUnitsSSE2(buf, from, to, ranges, count);
+#else
+  return scanUnitsScalar(buf, from, to, ranges, count);
+#endif
+}
+#endif  // COLORER_FEATURE_ICU
 
-StackElem* CRegExp::RegExpStack {nullptr};
-int CRegExp::RegExpStack_Size {0};
 /////////////////////////////////////////////////////////////////////////////
 //
 SRegInfo::SRegInfo()
@@ -35,8 +145,62 @@ SRegInfo::~SRegInfo()
     }
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// compact match record
+
+CompactMatches::CompactMatches(const SMatches& match)
+{
+  store(match);
+}
+
+void CompactMatches::store(const SMatches& match)
+{
+  int count = match.cMatch;
+#ifndef NAMED_MATCHES_IN_HASH
+  count += match.cnMatch;
+#endif
+  if (!positions || count != cMatch + cnMatch)
+    positions = std::make_unique<int[]>(count * 2);
+  cMatch = match.cMatch;
+  std::copy(match.s, match.s + cMatch, positions.get());
+  std::copy(match.e, match.e + cMatch, positions.get() + cMatch);
+#ifndef NAMED_MATCHES_IN_HASH
+  cnMatch = match.cnMatch;
+  std::copy(match.ns, match.ns + cnMatch, positions.get() + cMatch * 2);
+  std::copy(match.ne, match.ne + cnMatch, positions.get() + cMatch * 2 + cnMatch);
+#endif
+}
+
+void CompactMatches::restore(SMatches& match) const
+{
+  match.cMatch = cMatch;
+  if (cMatch) {
+    std::copy(positions.get(), positions.get() + cMatch, match.s);
+    std::copy(positions.get() + cMatch, positions.get() + cMatch * 2, match.e);
+  }
+#ifndef NAMED_MATCHES_IN_HASH
+  match.cnMatch = cnMatch;
+  if (cnMatch) {
+    std::copy(positions.get() + cMatch * 2, positions.get() + cMatch * 2 + cnMatch, match.ns);
+    std::copy(positions.get() + cMatch * 2 + cnMatch, positions.get() + (cMatch + cnMatch) * 2, match.ne);
+  }
+#endif
+}
+
+bool CompactMatches::operator==(const CompactMatches& other) const
+{
+  if (cMatch != other.cMatch || cnMatch != other.cnMatch)
+    return false;
+  const int count = (cMatch + cnMatch) * 2;
+  return count == 0 || std::equal(positions.get(), positions.get() + count, other.positions.get());
+}
+
 ////////////////////////////////////////////////////////////////////////////
 // CRegExp class
+
+std::atomic<EEngine> CRegExp::engine {EEngine::DFA};
+std::atomic<int> CRegExp::stepLimit {STEP_LIMIT_DEFAULT};
+
 void CRegExp::init()
 {
   tree_root = nullptr;
@@ -44,18 +208,18 @@ void CRegExp::init()
   error = EError::EERROR;
   firstChar = 0;
   cMatch = 0;
-  global_pattern = nullptr;
+  nodes_count = 0;
 #ifdef COLORERMODE
   backRE = nullptr;
   backStr = nullptr;
   backTrace = nullptr;
+  backTraced = false;
 #endif
 #ifndef NAMED_MATCHES_IN_HASH
   cnMatch = 0;
 #else
   namedMatches = 0;
 #endif
-  count_elem = 0;
 }
 CRegExp::CRegExp()
 {
@@ -83,6 +247,9 @@ EError CRegExp::setRELow(const UnicodeString& expr)
 
   delete tree_root;
   tree_root = nullptr;
+  code.clear();
+  foldedWords.clear();
+  dfa.reset();
 #ifndef NAMED_MATCHES_IN_HASH
   for (int bp = 0; bp < cnMatch; bp++) delete brnames[bp];
 #endif
@@ -91,7 +258,10 @@ EError CRegExp::setRELow(const UnicodeString& expr)
 #ifndef NAMED_MATCHES_IN_HASH
   cnMatch = 0;
 #endif
-  endChange = startChange = false;
+#ifdef COLORERMODE
+  backTraced = false;
+#endif
+  nodes_count = 0;
   int start = 0;
   while (Character::isWhitespace(expr[start])) start++;
   if (expr[start] == '/')
@@ -133,12 +303,356 @@ EError CRegExp::setRELow(const UnicodeString& expr)
 
   if (err != EError::EOK)
     return err;
+  nodes_count = enumerateNodes(tree_root, 0);
   optimize();
+  compile();
+  dfa = LazyDfa::create(tree_root, ignoreCase, singleLine, multiLine);
   return EError::EOK;
 }
 
+int CRegExp::enumerateNodes(SRegInfo* re, int id)
+{
+  for (; re; re = re->next) {
+    re->id = id++;
+    if (re->op > EOps::ReBlockOps &&
+        (re->op < EOps::ReSymbolOps || re->op == EOps::ReBrackets || re->op == EOps::ReNamedBrackets))
+      id = enumerateNodes(re->un.param, id);
+  }
+  return id;
+}
+
+void CRegExp::compile()
+{
+  code.resize(nodes_count);
+  foldTable = ignoreCase ? getFoldTable() : nullptr;
+  compileNodes(tree_root);
+}
+
+const UChar* CRegExp::getFoldTable()
+{
+  static const std::unique_ptr<UChar[]> table = [] {
+    auto t = std::make_unique<UChar[]>(0x10000);
+    for (int c = 0; c < 0x10000; c++) t[c] = Character::foldCase(static_cast<UChar>(c));
+    return t;
+  }();
+  return table.get();
+}
+
+#ifdef COLORERMODE
+/** Returns bracket of the back trace, brackets out of the match record are empty.
+*/
+static inline void backBracket(const SMatches& trace, int no, bool named, int& s, int& e)
+{
+#ifndef NAMED_MATCHES_IN_HASH
+  if (named) {
+    const bool in = no < trace.cnMatch;
+    s = in ? trace.ns[no] : 0;
+    e = in ? trace.ne[no] : 0;
+    return;
+  }
+#endif
+  const bool in = no < trace.cMatch;
+  s = in ? trace.s[no] : 0;
+  e = in ? trace.e[no] : 0;
+}
+#endif
+
+/** Character::toLowerCase() without the call for ASCII units.
+*/
+static inline UChar toLowerFast(UChar c)
+{
+  if (c < 0x80)
+    return c >= 'A' && c <= 'Z' ? static_cast<UChar>(c + 0x20) : c;
+  return Character::toLowerCase(c);
+}
+
+/** Compares characters as /i symbols of RE: lower or upper cases must be equal.
+*/
+static inline bool isSameCaseless(UChar c, UChar symbol)
+{
+  if ((c | symbol) < 0x80)
+    return toLowerFast(c) == toLowerFast(symbol);
+  return Character::toLowerCase(c) == Character::toLowerCase(symbol) ||
+      Character::toUpperCase(c) == Character::toUpperCase(symbol);
+}
+
+/** Checks, that comparison of the folded code units gives the same result
+    as UStr::caseCompare() with the word of the same length.
+*/
+static bool isFoldableWord(const UnicodeString& word)
+{
+#ifdef COLORER_FEATURE_ICU
+  // full case folding of the text is used, so the units of word must not expand
+  for (int i = 0; i < word.length(); i++) {
+    UChar c = word[i];
+    if (U16_IS_SURROGATE(c) || UnicodeString(c).foldCase().length() != 1)
+      return false;
+  }
+#else
+  (void) word;
+#endif
+  return true;
+}
+
+void CRegExp::compileNodes(const SRegInfo* re)
+{
+  for (; re; re = re->next) {
+    SRegCode& cd = code[re->id];
+    cd.un.word = nullptr;
+    switch (re->op) {
+      case EOps::ReMetaSymb:
+        cd.un.metaSymbol = re->un.metaSymbol;
+        break;
+      case EOps::ReSymb:
+        cd.un.symbol = re->un.symbol;
+        break;
+      case EOps::ReWord:
+        cd.un.word = re->un.word;
+        break;
+      case EOps::ReEnum:
+      case EOps::ReNEnum:
+        cd.un.charclass = re->un.charclass;
+        break;
+      default:
+        break;
+    }
+    cd.op = re->op;
+    if (re->op == EOps::ReWord && foldTable && isFoldableWord(*re->un.word)) {
+      auto word = std::make_unique<UnicodeString>();
+      for (int i = 0; i < re->un.word->length(); i++) word->append(foldTable[(*re->un.word)[i]]);
+      cd.un.word = word.get();
+      cd.op = EOps::ReFoldWord;
+      foldedWords.push_back(std::move(word));
+    }
+#if defined NAMED_MATCHES_IN_HASH
+    cd.namedata = re->namedata;
+#endif
+    // links keep the tree structure as is, including parents of the nodes inside the sequence
+    cd.next = re->next ? re->next->id - re->id : 0;
+    cd.parent = re->parent ? re->parent->id - re->id : 0;
+    cd.param0 = re->param0;
+    cd.s = re->s;
+    cd.e = re->e;
+    cd.id = re->id;
+    if (re->op > EOps::ReBlockOps &&
+        (re->op < EOps::ReSymbolOps || re->op == EOps::ReBrackets || re->op == EOps::ReNamedBrackets))
+      compileNodes(re->un.param);
+  }
+}
+
+static bool isConsumingMeta(EMetaSymbols symb)
+{
+  switch (symb) {
+    case EMetaSymbols::ReAnyChr:
+    case EMetaSymbols::ReDigit:
+    case EMetaSymbols::ReNDigit:
+    case EMetaSymbols::ReWordSymb:
+    case EMetaSymbols::ReNWordSymb:
+    case EMetaSymbols::ReWSpace:
+    case EMetaSymbols::ReNWSpace:
+    case EMetaSymbols::ReUCase:
+    case EMetaSymbols::ReNUCase:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static void addCharRange(CharacterClass& cc, UChar from, UChar to)
+{
+#ifdef COLORER_FEATURE_ICU
+  cc.add(from, to);
+#else
+  cc.addRange(from, to);
+#endif
+}
+
+static void addCharClass(CharacterClass& cc, const CharacterClass& add)
+{
+#ifdef COLORER_FEATURE_ICU
+  cc.addAll(add);
+#else
+  cc.addClass(add);
+#endif
+}
+
+bool CRegExp::addFirstChars(const SRegInfo* re, CharacterClass& cc, bool& any) const
+{
+  for (; re && !any; re = re->next) {
+    switch (re->op) {
+      case EOps::ReOr: {
+        // left alternative and the rest of sequence are both continued after the sequence
+        bool empty = addFirstChars(re->un.param, cc, any);
+        return addFirstChars(re->next, cc, any) || empty;
+      }
+      case EOps::ReBrackets:
+      case EOps::ReNamedBrackets:
+        if (!addFirstChars(re->un.param, cc, any))
+          return false;
+        break;
+      case EOps::ReRangeN:
+      case EOps::ReRangeNM:
+      case EOps::ReNGRangeN:
+      case EOps::ReNGRangeNM:
+        if (!addFirstChars(re->un.param, cc, any) && re->s > 0)
+          return false;
+        break;
+      case EOps::ReSymb:
+      case EOps::ReWord: {
+        UChar c = re->op == EOps::ReSymb ? re->un.symbol : (*re->un.word)[0];
+        if (ignoreCase) {
+          // non ASCII characters could have case mappings into ASCII
+          if (c >= 0x80) {
+            any = true;
+            return false;
+          }
+          cc.add(Character::toLowerCase(c));
+          cc.add(Character::toUpperCase(c));
+          addCharRange(cc, 0x80, 0xFFFF);
+        }
+        else
+          cc.add(c);
+        return false;
+      }
+      case EOps::ReEnum:
+        addCharClass(cc, *re->un.charclass);
+        return false;
+      case EOps::ReMetaSymb: {
+        if (!isConsumingMeta(re->un.metaSymbol))
+          break;
+        // ASCII part of the meta symbol class is taken from the matcher itself
+        UChar ascii[0x80];
+        for (int i = 0; i < 0x80; i++) ascii[i] = static_cast<UChar>(i);
+        UnicodeString probe(ascii, 0x80);
+        MatchContext ctx;
+        ctx.global_pattern = &probe;
+        ctx.end = 0x80;
+        for (int i = 0; i < 0x80; i++) {
+          int toParse = i;
+          if (checkMetaSymbol(ctx, re->un.metaSymbol, toParse))
+            cc.add(static_cast<UChar>(i));
+        }
+        addCharRange(cc, 0x80, 0xFFFF);
+        return false;
+      }
+      case EOps::ReEmpty:
+      case EOps::ReAhead:
+      case EOps::ReNAhead:
+      case EOps::ReBehind:
+      case EOps::ReNBehind:
+        break;
+      default:
+        // back references and others
+        any = true;
+        return false;
+    }
+  }
+  return !any;
+}
+
+bool CRegExp::addFirstWord(const SRegInfo* re, UnicodeString& word) const
+{
+  for (; re; re = re->next) {
+    switch (re->op) {
+      case EOps::ReSymb:
+        word.append(re->un.symbol);
+        break;
+      case EOps::ReWord:
+        word.append(*re->un.word);
+        break;
+      case EOps::ReBrackets:
+      case EOps::ReNamedBrackets:
+        if (!addFirstWord(re->un.param, word))
+          return false;
+        break;
+      case EOps::ReRangeN:
+      case EOps::ReRangeNM:
+      case EOps::ReNGRangeN:
+      case EOps::ReNGRangeNM:
+        if (re->s > 0)
+          addFirstWord(re->un.param, word);
+        return false;
+      case EOps::ReMetaSymb:
+        if (isConsumingMeta(re->un.metaSymbol))
+          return false;
+        break;
+      case EOps::ReEmpty:
+      case EOps::ReAhead:
+      case EOps::ReNAhead:
+      case EOps::ReBehind:
+      case EOps::ReNBehind:
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+void CRegExp::findRequiredWord(const SRegInfo* re, UnicodeString& word) const
+{
+  // no required parts in alternatives
+  for (const SRegInfo* next = re; next; next = next->next)
+    if (next->op == EOps::ReOr)
+      return;
+  for (; re; re = re->next) {
+    switch (re->op) {
+      case EOps::ReWord:
+        if (re->un.word->length() > word.length())
+          word = *re->un.word;
+        break;
+      case EOps::ReBrackets:
+      case EOps::ReNamedBrackets:
+        findRequiredWord(re->un.param, word);
+        break;
+      case EOps::ReRangeN:
+      case EOps::ReRangeNM:
+      case EOps::ReNGRangeN:
+      case EOps::ReNGRangeNM:
+        if (re->s > 0)
+          findRequiredWord(re->un.param, word);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
 void CRegExp::optimize()
 {
+  firstWord = UnicodeString();
+  firstClass.reset();
+  requiredWord = UnicodeString();
+  if (!ignoreCase) {
+    addFirstWord(tree_root, firstWord);
+    findRequiredWord(tree_root, requiredWord);
+    // first word is checked for every position
+    if (firstWord.indexOf(requiredWord) != -1)
+      requiredWord = UnicodeString();
+  }
+  if (firstWord.isEmpty()) {
+    auto cc = std::make_unique<CharacterClass>();
+    bool any = false;
+    if (!addFirstChars(tree_root, *cc, any) && !any) {
+      cc->freeze();
+      firstClass = std::move(cc);
+    }
+  }
+#ifdef COLORER_FEATURE_ICU
+  scanRangesCount = 0;
+  if (!firstWord.isEmpty()) {
+    scanRanges[0][0] = scanRanges[0][1] = firstWord[0];
+    scanRangesCount = 1;
+  }
+  else if (firstClass && firstClass->getRangeCount() <= SCAN_RANGES_NUM) {
+    for (int i = 0; i < firstClass->getRangeCount() && firstClass->getRangeStart(i) <= 0xFFFF; i++) {
+      scanRanges[i][0] = static_cast<UChar>(firstClass->getRangeStart(i));
+      scanRanges[i][1] = static_cast<UChar>(std::min(firstClass->getRangeEnd(i), 0xFFFF));
+      scanRangesCount++;
+    }
+  }
+#endif
+
   SRegInfo* next = tree_root;
   firstChar = BAD_WCHAR;
   firstMetaChar = EMetaSymbols::ReBadMeta;
@@ -269,6 +783,7 @@ EError CRegExp::setStructs(SRegInfo*& re, const UnicodeString& expr, int& retPos
         case 'y':
         case 'Y':
           next->op = (expr[i + 1] == 'y' ? EOps::ReBkTrace : EOps::ReBkTraceN);
+          backTraced = true;
           next->param0 = UnicodeTools::getHex(expr[i + 2]);
           if (next->param0 != -1) {
             i++;
@@ -669,27 +1184,27 @@ EError CRegExp::setStructs(SRegInfo*& re, const UnicodeString& expr, int& retPos
 // parsing
 ////////////////////////////////////////////////////////////////////////////
 
-bool CRegExp::isWordBoundary(int toParse)
+bool CRegExp::isWordBoundary(const MatchContext& ctx, int toParse) const
 {
+  const UnicodeString& pattern = *ctx.global_pattern;
   int before = 0;
   int after = 0;
-  if (toParse < end &&
-      (Character::isLetterOrDigit((*global_pattern)[toParse]) || (*global_pattern)[toParse] == '_'))
+  if (toParse < ctx.end && (Character::isLetterOrDigit(pattern[toParse]) || pattern[toParse] == '_'))
     after = 1;
   if (toParse > 0 &&
-      (Character::isLetterOrDigit((*global_pattern)[toParse - 1]) ||
-       (*global_pattern)[toParse - 1] == '_'))
+      (Character::isLetterOrDigit(pattern[toParse - 1]) || pattern[toParse - 1] == '_'))
     before = 1;
   return before + after == 1;
 }
-bool CRegExp::isNWordBoundary(int toParse)
+bool CRegExp::isNWordBoundary(const MatchContext& ctx, int toParse) const
 {
-  return !isWordBoundary(toParse);
+  return !isWordBoundary(ctx, toParse);
 }
 
-bool CRegExp::checkMetaSymbol(EMetaSymbols symb, int& toParse)
+bool CRegExp::checkMetaSymbol(MatchContext& ctx, EMetaSymbols symb, int& toParse) const
 {
-  const UnicodeString& pattern = *global_pattern;
+  const UnicodeString& pattern = *ctx.global_pattern;
+  const int end = ctx.end;
 
   switch (symb) {
     case EMetaSymbols::ReAnyChr:
@@ -768,23 +1283,23 @@ bool CRegExp::checkMetaSymbol(EMetaSymbols symb, int& toParse)
       toParse++;
       return true;
     case EMetaSymbols::ReWBound:
-      return isWordBoundary(toParse);
+      return isWordBoundary(ctx, toParse);
     case EMetaSymbols::ReNWBound:
-      return isNWordBoundary(toParse);
+      return isNWordBoundary(ctx, toParse);
     case EMetaSymbols::RePreNW:
       if (toParse >= end)
         return true;
       return toParse == 0 || !Character::isLetter(pattern[toParse - 1]);
 #ifdef COLORERMODE
     case EMetaSymbols::ReSoScheme:
-      return (schemeStart == toParse);
+      return (ctx.schemeStart == toParse);
     case EMetaSymbols::ReStart:
-      matches->s[0] = toParse;
-      startChange = true;
+      ctx.matches->s[0] = toParse;
+      ctx.startChange = true;
       return true;
     case EMetaSymbols::ReEnd:
-      matches->e[0] = toParse;
-      endChange = true;
+      ctx.matches->e[0] = toParse;
+      ctx.endChange = true;
       return true;
 #endif
     default:
@@ -792,15 +1307,16 @@ bool CRegExp::checkMetaSymbol(EMetaSymbols symb, int& toParse)
   }
 }
 
-void CRegExp::check_stack(bool res, SRegInfo** re, SRegInfo** prev, int* toParse, bool* leftenter,
-                          int* action)
+template <class Node>
+void CRegExp::check_stack(RegExpStack<Node>& stack, bool res, const Node** re, const Node** prev,
+                          int* toParse, bool* leftenter, int* action)
 {
-  if (count_elem == 0) {
+  if (stack.empty()) {
     *action = res;
     return;
   }
 
-  StackElem& ne = CRegExp::RegExpStack[--count_elem];
+  StackElem<Node>& ne = stack.pop();
   if (res) {
     *action = ne.ifTrueReturn;
   }
@@ -813,22 +1329,12 @@ void CRegExp::check_stack(bool res, SRegInfo** re, SRegInfo** prev, int* toParse
   *leftenter = ne.leftenter;
 }
 
-void CRegExp::insert_stack(SRegInfo** re, SRegInfo** prev, int* toParse, bool* leftenter,
-                           int ifTrueReturn, int ifFalseReturn, SRegInfo** re2, SRegInfo** prev2,
-                           int toParse2)
+template <class Node>
+void CRegExp::insert_stack(RegExpStack<Node>& stack, const Node** re, const Node** prev, int* toParse,
+                           bool* leftenter, int ifTrueReturn, int ifFalseReturn, const Node* re2,
+                           const Node* prev2, int toParse2)
 {
-  if (RegExpStack_Size == 0) {
-    CRegExp::RegExpStack = new StackElem[INIT_MEM_SIZE];
-    RegExpStack_Size = INIT_MEM_SIZE;
-  }
-  if (RegExpStack_Size == count_elem) {
-    RegExpStack_Size += MEM_INC;
-    StackElem* s = new StackElem[RegExpStack_Size];
-    memcpy(s, CRegExp::RegExpStack, count_elem * sizeof(StackElem));
-    delete[] CRegExp::RegExpStack;
-    CRegExp::RegExpStack = s;
-  }
-  StackElem& ne = CRegExp::RegExpStack[count_elem++];
+  StackElem<Node>& ne = stack.push();
   ne.re = *re;
   ne.prev = *prev;
   ne.toParse = *toParse;
@@ -836,34 +1342,46 @@ void CRegExp::insert_stack(SRegInfo** re, SRegInfo** prev, int* toParse, bool* l
   ne.ifFalseReturn = ifFalseReturn;
   ne.leftenter = *leftenter;
 
-  if (prev2 == nullptr)
-    *prev = nullptr;
-  else
-    *prev = *prev2;
-  *re = *re2;
+  *prev = prev2;
+  *re = re2;
   *toParse = toParse2;
   // this is init operation from lowParse
   *leftenter = true;
   if (!*re) {
-    *re = (*prev)->parent;
+    *re = (*prev)->getParent();
     *leftenter = false;
   }
 }
 
-bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
+template <class Node>
+bool CRegExp::lowParse(MatchContext& ctx, RegExpStack<Node>& stack, const Node* re, const Node* prev,
+                       int toParse) const
 {
   int i, sv, wlen;
+#ifdef COLORERMODE
+  // bracket of the back trace
+  int bs, be;
+#endif
   bool leftenter = true;
   bool br = false;
-  const UnicodeString& pattern = *global_pattern;
+  const UnicodeString& pattern = *ctx.global_pattern;
+  const int end = ctx.end;
+  SMatches* const matches = ctx.matches;
+  SRegState* const st = ctx.states.data();
   int action = -1;
 
   if (!re) {
-    re = prev->parent;
+    re = prev->getParent();
     leftenter = false;
   }
   while (true) {
     while (re || action != -1) {
+      // backtracking steps are counted by insert_stack()
+      if (ctx.stepLimit && stack.getSteps() > ctx.stepLimit) {
+        stack.reset();
+        ctx.stepLimitReached = true;
+        return false;
+      }
       if (re && action == -1)
         switch (re->op) {
           case EOps::ReEmpty:
@@ -871,67 +1389,64 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
           case EOps::ReBrackets:
           case EOps::ReNamedBrackets:
             if (leftenter) {
-              re->s = toParse;
-              re = re->un.param;
+              st[re->id].s = toParse;
+              re = re->getParam();
               continue;
             }
             if (re->param0 == -1)
               break;
             if (re->op == EOps::ReBrackets) {
-              if (re->param0 || !startChange)
-                matches->s[re->param0] = re->s;
-              if (re->param0 || !endChange)
+              if (re->param0 || !ctx.startChange)
+                matches->s[re->param0] = st[re->id].s;
+              if (re->param0 || !ctx.endChange)
                 matches->e[re->param0] = toParse;
               if (matches->e[re->param0] < matches->s[re->param0])
                 matches->s[re->param0] = matches->e[re->param0];
             }
             else {
 #ifndef NAMED_MATCHES_IN_HASH
-              matches->ns[re->param0] = re->s;
+              matches->ns[re->param0] = st[re->id].s;
               matches->ne[re->param0] = toParse;
               if (matches->ne[re->param0] < matches->ns[re->param0])
                 matches->ns[re->param0] = matches->ne[re->param0];
 #else
-              SMatch mt = {re->s, toParse};
-              namedMatches->setItem(re->namedata, mt);
+              SMatch mt = {st[re->id].s, toParse};
+              ctx.namedMatches->setItem(re->namedata, mt);
 #endif
             }
             break;
           case EOps::ReSymb:
             if (toParse >= end) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             if (ignoreCase) {
-              if (Character::toLowerCase(pattern[toParse]) !=
-                      Character::toLowerCase(re->un.symbol) &&
-                  Character::toUpperCase(pattern[toParse]) != Character::toUpperCase(re->un.symbol))
-              {
-                check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              if (!isSameCaseless(pattern[toParse], re->un.symbol)) {
+                check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
                 continue;
               }
             }
             else if (pattern[toParse] != re->un.symbol) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             toParse++;
             break;
           case EOps::ReMetaSymb:
-            if (!checkMetaSymbol(re->un.metaSymbol, toParse)) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+            if (!checkMetaSymbol(ctx, re->un.metaSymbol, toParse)) {
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             break;
           case EOps::ReWord:
             wlen = re->un.word->length();
             if (toParse + wlen > end) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             if (ignoreCase) {
               if (UStr::caseCompare(UnicodeString(pattern, toParse, wlen),*re->un.word)!=0) {
-                check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+                check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
                 continue;
               }
               toParse += wlen;
@@ -940,7 +1455,7 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
               br = false;
               for (i = 0; i < wlen; i++) {
                 if (pattern[toParse + i] != (*re->un.word)[i]) {
-                  check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+                  check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
                   br = true;
                   break;
                 }
@@ -950,24 +1465,42 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
               toParse += wlen;
             }
             break;
+          case EOps::ReFoldWord:
+            wlen = re->un.word->length();
+            if (toParse + wlen > end) {
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
+              continue;
+            }
+            br = false;
+            for (i = 0; i < wlen; i++) {
+              if (foldTable[pattern[toParse + i]] != (*re->un.word)[i]) {
+                check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
+                br = true;
+                break;
+              }
+            }
+            if (br)
+              continue;
+            toParse += wlen;
+            break;
           case EOps::ReEnum:
             if (toParse >= end) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             if (!re->un.charclass->contains(pattern[toParse])) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             toParse++;
             break;
           case EOps::ReNEnum:
             if (toParse >= end) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             if (re->un.charclass->contains(pattern[toParse])) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             toParse++;
@@ -975,14 +1508,15 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
 #ifdef COLORERMODE
           case EOps::ReBkTrace:
             sv = re->param0;
-            if (!backStr || !backTrace || sv == -1) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+            if (!ctx.backStr || !ctx.backTrace || sv == -1) {
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             br = false;
-            for (i = backTrace->s[sv]; i < backTrace->e[sv]; i++) {
-              if (toParse >= end || pattern[toParse] != (*backStr)[i]) {
-                check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+            backBracket(*ctx.backTrace, sv, false, bs, be);
+            for (i = bs; i < be; i++) {
+              if (toParse >= end || pattern[toParse] != (*ctx.backStr)[i]) {
+                check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
                 br = true;
                 break;
               }
@@ -993,16 +1527,17 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
             break;
           case EOps::ReBkTraceN:
             sv = re->param0;
-            if (!backStr || !backTrace || sv == -1) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+            if (!ctx.backStr || !ctx.backTrace || sv == -1) {
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             br = false;
-            for (i = backTrace->s[sv]; i < backTrace->e[sv]; i++) {
+            backBracket(*ctx.backTrace, sv, false, bs, be);
+            for (i = bs; i < be; i++) {
               if (toParse >= end ||
-                  Character::toLowerCase(pattern[toParse]) != Character::toLowerCase((*backStr)[i]))
+                  toLowerFast(pattern[toParse]) != toLowerFast((*ctx.backStr)[i]))
               {
-                check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+                check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
                 br = true;
                 break;
               }
@@ -1014,14 +1549,15 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
           case EOps::ReBkTraceName:
 #ifndef NAMED_MATCHES_IN_HASH
             sv = re->param0;
-            if (!backStr || !backTrace || sv == -1) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+            if (!ctx.backStr || !ctx.backTrace || sv == -1) {
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             br = false;
-            for (i = backTrace->ns[sv]; i < backTrace->ne[sv]; i++) {
-              if (toParse >= end || pattern[toParse] != (*backStr)[i]) {
-                check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+            backBracket(*ctx.backTrace, sv, true, bs, be);
+            for (i = bs; i < be; i++) {
+              if (toParse >= end || pattern[toParse] != (*ctx.backStr)[i]) {
+                check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
                 br = true;
                 break;
               }
@@ -1033,23 +1569,24 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
 #else
             // !!!;
             {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
 #endif  // NAMED_MATCHES_IN_HASH
           case EOps::ReBkTraceNName:
 #ifndef NAMED_MATCHES_IN_HASH
             sv = re->param0;
-            if (!backStr || !backTrace || sv == -1) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+            if (!ctx.backStr || !ctx.backTrace || sv == -1) {
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             br = false;
-            for (i = backTrace->s[sv]; i < backTrace->e[sv]; i++) {
+            backBracket(*ctx.backTrace, sv, false, bs, be);
+            for (i = bs; i < be; i++) {
               if (toParse >= end ||
-                  Character::toLowerCase(pattern[toParse]) != Character::toLowerCase((*backStr)[i]))
+                  toLowerFast(pattern[toParse]) != toLowerFast((*ctx.backStr)[i]))
               {
-                check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+                check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
                 br = true;
                 break;
               }
@@ -1061,7 +1598,7 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
 #else
             // !!;
             {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
 #endif  // NAMED_MATCHES_IN_HASH
@@ -1071,17 +1608,17 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
 #ifndef NAMED_MATCHES_IN_HASH
             sv = re->param0;
             if (sv == -1 || cnMatch <= sv) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             if (matches->ns[sv] == -1 || matches->ne[sv] == -1) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             br = false;
             for (i = matches->ns[sv]; i < matches->ne[sv]; i++) {
               if (toParse >= end || pattern[toParse] != pattern[i]) {
-                check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+                check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
                 br = true;
                 break;
               }
@@ -1092,19 +1629,19 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
             break;
 #else
           {
-            SMatch* mt = namedMatches->getItem(re->namedata);
+            SMatch* mt = ctx.namedMatches->getItem(re->namedata);
             if (!mt) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             if (mt->s == -1 || mt->e == -1) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             br = false;
             for (i = mt->s; i < mt->e; i++) {
               if (toParse >= end || pattern[toParse] != pattern[i]) {
-                check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+                check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
                 br = true;
                 break;
               }
@@ -1118,17 +1655,17 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
           case EOps::ReBkBrack:
             sv = re->param0;
             if (sv == -1 || cMatch <= sv) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             if (matches->s[sv] == -1 || matches->e[sv] == -1) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             br = false;
             for (i = matches->s[sv]; i < matches->e[sv]; i++) {
               if (toParse >= end || pattern[toParse] != pattern[i]) {
-                check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+                check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
                 br = true;
                 break;
               }
@@ -1139,48 +1676,48 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
             break;
           case EOps::ReAhead:
             if (!leftenter) {
-              check_stack(true, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, true, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             {
-              insert_stack(&re, &prev, &toParse, &leftenter, rea_Break, rea_False, &re->un.param,
+              insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_Break, rea_False, re->getParam(),
                            nullptr, toParse);
               continue;
             }
             break;
           case EOps::ReNAhead:
             if (!leftenter) {
-              check_stack(true, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, true, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             {
-              insert_stack(&re, &prev, &toParse, &leftenter, rea_False, rea_Break, &re->un.param,
+              insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_False, rea_Break, re->getParam(),
                            nullptr, toParse);
               continue;
             }
             break;
           case EOps::ReBehind:
             if (!leftenter) {
-              check_stack(true, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, true, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             if (toParse - re->param0 < 0) {
-              check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             else {
-              insert_stack(&re, &prev, &toParse, &leftenter, rea_Break, rea_False, &re->un.param,
+              insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_Break, rea_False, re->getParam(),
                            nullptr, toParse - re->param0);
               continue;
             }
             break;
           case EOps::ReNBehind:
             if (!leftenter) {
-              check_stack(true, &re, &prev, &toParse, &leftenter, &action);
+              check_stack(stack, true, &re, &prev, &toParse, &leftenter, &action);
               continue;
             }
             if (toParse - re->param0 >= 0) {
-              insert_stack(&re, &prev, &toParse, &leftenter, rea_False, rea_Break, &re->un.param,
+              insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_False, rea_Break, re->getParam(),
                            nullptr, toParse - re->param0);
               continue;
             }
@@ -1188,11 +1725,11 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
 
           case EOps::ReOr:
             if (!leftenter) {
-              while (re->next) re = re->next;
+              while (re->getNext()) re = re->getNext();
               break;
             }
             {
-              insert_stack(&re, &prev, &toParse, &leftenter, rea_True, rea_Break, &re->un.param,
+              insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_True, rea_Break, re->getParam(),
                            nullptr, toParse);
               continue;
             }
@@ -1200,91 +1737,91 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
           case EOps::ReRangeN:
             // first enter into op
             if (leftenter) {
-              re->param0 = re->s;
-              re->oldParse = -1;
+              st[re->id].param0 = re->s;
+              st[re->id].oldParse = -1;
             }
-            if (!re->param0 && re->oldParse == toParse)
+            if (!st[re->id].param0 && st[re->id].oldParse == toParse)
               break;
-            re->oldParse = toParse;
+            st[re->id].oldParse = toParse;
             // making branch
-            if (!re->param0) {
-              insert_stack(&re, &prev, &toParse, &leftenter, rea_True, rea_RangeN_step2,
-                           &re->un.param, nullptr, toParse);
+            if (!st[re->id].param0) {
+              insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_True, rea_RangeN_step2,
+                           re->getParam(), nullptr, toParse);
               continue;
             }
             else {
               // go into
-              re->param0--;
+              st[re->id].param0--;
             }
-            re = re->un.param;
+            re = re->getParam();
             leftenter = true;
             continue;
           case EOps::ReRangeNM:
             if (leftenter) {
-              re->param0 = re->s;
-              re->param1 = re->e - re->s;
-              re->oldParse = -1;
+              st[re->id].param0 = re->s;
+              st[re->id].param1 = re->e - re->s;
+              st[re->id].oldParse = -1;
             }
-            if (!re->param0) {
-              if (re->param1)
-                re->param1--;
+            if (!st[re->id].param0) {
+              if (st[re->id].param1)
+                st[re->id].param1--;
               else {
-                insert_stack(&re, &prev, &toParse, &leftenter, rea_True, rea_False, &re->next, &re,
+                insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_True, rea_False, re->getNext(), re,
                              toParse);
                 continue;
               }
               {
-                insert_stack(&re, &prev, &toParse, &leftenter, rea_True, rea_RangeNM_step2,
-                             &re->un.param, nullptr, toParse);
+                insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_True, rea_RangeNM_step2,
+                             re->getParam(), nullptr, toParse);
                 continue;
               }
             }
             else
-              re->param0--;
-            re = re->un.param;
+              st[re->id].param0--;
+            re = re->getParam();
             leftenter = true;
             continue;
           case EOps::ReNGRangeN:
             if (leftenter) {
-              re->param0 = re->s;
-              re->oldParse = -1;
+              st[re->id].param0 = re->s;
+              st[re->id].oldParse = -1;
             }
-            if (!re->param0 && re->oldParse == toParse)
+            if (!st[re->id].param0 && st[re->id].oldParse == toParse)
               break;
-            re->oldParse = toParse;
-            if (!re->param0) {
-              insert_stack(&re, &prev, &toParse, &leftenter, rea_True, rea_NGRangeN_step2,
-                           &re->next, &re, toParse);
+            st[re->id].oldParse = toParse;
+            if (!st[re->id].param0) {
+              insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_True, rea_NGRangeN_step2,
+                           re->getNext(), re, toParse);
               continue;
             }
             else
-              re->param0--;
-            re = re->un.param;
+              st[re->id].param0--;
+            re = re->getParam();
             leftenter = true;
             continue;
           case EOps::ReNGRangeNM:
             if (leftenter) {
-              re->param0 = re->s;
-              re->param1 = re->e - re->s;
-              re->oldParse = -1;
+              st[re->id].param0 = re->s;
+              st[re->id].param1 = re->e - re->s;
+              st[re->id].oldParse = -1;
             }
-            if (!re->param0) {
-              if (re->param1)
-                re->param1--;
+            if (!st[re->id].param0) {
+              if (st[re->id].param1)
+                st[re->id].param1--;
               else {
-                insert_stack(&re, &prev, &toParse, &leftenter, rea_True, rea_False, &re->next, &re,
+                insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_True, rea_False, re->getNext(), re,
                              toParse);
                 continue;
               }
               {
-                insert_stack(&re, &prev, &toParse, &leftenter, rea_True, rea_NGRangeNM_step2,
-                             &re->next, &re, toParse);
+                insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_True, rea_NGRangeNM_step2,
+                             re->getNext(), re, toParse);
                 continue;
               }
             }
             else
-              re->param0--;
-            re = re->un.param;
+              st[re->id].param0--;
+            re = re->getParam();
             leftenter = true;
             continue;
           case EOps::ReBlockOps:
@@ -1300,16 +1837,16 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
 
       switch (action) {
         case rea_False:
-          if (count_elem) {
-            check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+          if (!stack.empty()) {
+            check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
             continue;
           }
           else
             return false;
           break;
         case rea_True:
-          if (count_elem) {
-            check_stack(true, &re, &prev, &toParse, &leftenter, &action);
+          if (!stack.empty()) {
+            check_stack(stack, true, &re, &prev, &toParse, &leftenter, &action);
             continue;
           }
           else
@@ -1320,67 +1857,108 @@ bool CRegExp::lowParse(SRegInfo* re, SRegInfo* prev, int toParse)
           break;
         case rea_RangeN_step2:
           action = -1;
-          insert_stack(&re, &prev, &toParse, &leftenter, rea_True, rea_False, &re->next,
-                       &re,  //-V522
+          insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_True, rea_False, re->getNext(),
+                       re,  //-V522
                        toParse);
           continue;
           break;
         case rea_RangeNM_step2:
           action = -1;
-          insert_stack(&re, &prev, &toParse, &leftenter, rea_True, rea_RangeNM_step3, &re->next,
-                       &re, toParse);
+          insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_True, rea_RangeNM_step3, re->getNext(),
+                       re, toParse);
           continue;
           break;
         case rea_RangeNM_step3:
           action = -1;  //-V1037
-          re->param1++;
-          check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+          st[re->id].param1++;
+          check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
           continue;
           break;
         case rea_NGRangeN_step2:
           action = -1;
-          if (re->param0)
-            re->param0--;
-          re = re->un.param;
+          if (st[re->id].param0)
+            st[re->id].param0--;
+          re = re->getParam();
           leftenter = true;
           continue;
           break;
         case rea_NGRangeNM_step2:
           action = -1;
-          insert_stack(&re, &prev, &toParse, &leftenter, rea_True, rea_NGRangeNM_step3,
-                       &re->un.param, nullptr, toParse);
+          insert_stack<Node>(stack, &re, &prev, &toParse, &leftenter, rea_True, rea_NGRangeNM_step3,
+                       re->getParam(), nullptr, toParse);
           continue;
           break;
         case rea_NGRangeNM_step3:
           action = -1;
-          re->param1++;
-          check_stack(false, &re, &prev, &toParse, &leftenter, &action);
+          st[re->id].param1++;
+          check_stack(stack, false, &re, &prev, &toParse, &leftenter, &action);
           continue;
           break;
       }
-      if (!re->next) {
-        re = re->parent;
+      if (!re->getNext()) {
+        re = re->getParent();
         leftenter = false;
       }
       else {
-        re = re->next;
+        re = re->getNext();
         leftenter = true;
       }
     }
-    check_stack(true, &re, &prev, &toParse, &leftenter, &action);
+    check_stack(stack, true, &re, &prev, &toParse, &leftenter, &action);
   }
 }
 
-inline bool CRegExp::quickCheck(int toParse)
+inline bool CRegExp::checkFirst(const MatchContext& ctx, int toParse) const
 {
+  const UnicodeString& pattern = *ctx.global_pattern;
+  if (firstClass) {
+    return toParse < ctx.end && firstClass->contains(pattern[toParse]);
+  }
+  const int wlen = firstWord.length();
+  if (wlen) {
+    if (toParse + wlen > ctx.end || pattern[toParse] != firstWord[0])
+      return false;
+    for (int i = 1; i < wlen; i++)
+      if (pattern[toParse + i] != firstWord[i])
+        return false;
+  }
+  return true;
+}
+
+inline int CRegExp::findFirst(const MatchContext& ctx, int toParse) const
+{
+  if (!firstClass && firstWord.isEmpty())
+    return toParse;
+  const int end = ctx.end;
+#ifdef COLORER_FEATURE_ICU
+  if (scanRangesCount && end <= ctx.global_pattern->length()) {
+    const UChar* buf = ctx.global_pattern->getBuffer();
+    for (; toParse < end; toParse++) {
+      toParse = scanUnits(buf, toParse, end, scanRanges, scanRangesCount);
+      if (toParse < end && checkFirst(ctx, toParse))
+        return toParse;
+    }
+    return -1;
+  }
+#endif
+  for (; toParse < end; toParse++)
+    if (checkFirst(ctx, toParse))
+      return toParse;
+  return -1;
+}
+
+inline bool CRegExp::quickCheck(const MatchContext& ctx, int toParse) const
+{
+  if (!checkFirst(ctx, toParse))
+    return false;
   if (firstChar != BAD_WCHAR) {
-    if (toParse >= end)
+    if (toParse >= ctx.end)
       return false;
     if (ignoreCase) {
-      if (Character::toLowerCase((*global_pattern)[toParse]) != Character::toLowerCase(firstChar))
+      if (toLowerFast((*ctx.global_pattern)[toParse]) != toLowerFast(firstChar))
         return false;
     }
-    else if ((*global_pattern)[toParse] != firstChar)
+    else if ((*ctx.global_pattern)[toParse] != firstChar)
       return false;
     return true;
   }
@@ -1392,7 +1970,7 @@ inline bool CRegExp::quickCheck(int toParse)
         return true;
 #ifdef COLORERMODE
       case EMetaSymbols::ReSoScheme:
-        if (toParse != schemeStart)
+        if (toParse != ctx.schemeStart)
           return false;
         return true;
 #endif
@@ -1421,32 +1999,78 @@ inline bool CRegExp::quickCheck(int toParse)
   return true;
 }
 
-inline bool CRegExp::parseRE(int pos)
+inline bool CRegExp::parseRE(MatchContext& ctx, int pos, bool moves) const
 {
   if (error != EError::EOK)
     return false;
 
   int toParse = pos;
 
-  if (!positionMoves && (firstChar != BAD_WCHAR || firstMetaChar != EMetaSymbols::ReBadMeta) &&
-      !quickCheck(toParse))
+  if (!moves && !quickCheck(ctx, toParse))
     return false;
 
-  int i;
-  for (i = 0; i < cMatch; i++) matches->s[i] = matches->e[i] = -1;
+  if (static_cast<int>(ctx.states.size()) < nodes_count)
+    ctx.states.resize(nodes_count);
+
+  ctx.stepLimitReached = false;
+  ctx.stepLimit = stepLimit.load(std::memory_order_relaxed);
+  const EEngine eng = engine.load(std::memory_order_relaxed);
+
+  SMatches* matches = ctx.matches;
   matches->cMatch = cMatch;
 #ifndef NAMED_MATCHES_IN_HASH
-  for (i = 0; i < cnMatch; i++) matches->ns[i] = matches->ne[i] = -1;
   matches->cnMatch = cnMatch;
 #endif
+  // position of the required word, which is not before toParse
+  int required = -1;
   do {
-    // stack=null;
-    if (lowParse(tree_root, nullptr, toParse))
+    if (moves) {
+      toParse = findFirst(ctx, toParse);
+      if (toParse == -1)
+        return false;
+      if (!requiredWord.isEmpty() && required < toParse) {
+        required = ctx.global_pattern->indexOf(requiredWord, toParse);
+        if (required == -1 || required + requiredWord.length() > ctx.end)
+          return false;
+      }
+    }
+    // results of the failed tries are not kept
+    int i;
+    for (i = 0; i < cMatch; i++) matches->s[i] = matches->e[i] = -1;
+#ifndef NAMED_MATCHES_IN_HASH
+    for (i = 0; i < cnMatch; i++) matches->ns[i] = matches->ne[i] = -1;
+#endif
+    ctx.startChange = ctx.endChange = false;
+    // each start position has its own limit of backtracking steps
+    ctx.stack.reset();
+    ctx.code_stack.reset();
+    if (eng == EEngine::DFA && dfa) {
+      const int matchEnd = dfa->match(*ctx.global_pattern, toParse, ctx.end, ctx.schemeStart);
+      // brackets are filled by the backtracker, when DFA has found the match
+      if (matchEnd >= 0 && cMatch == 1 && !cnMatch) {
+        matches->s[0] = toParse;
+        matches->e[0] = matchEnd;
+        return true;
+      }
+      if (matchEnd == LazyDfa::NO_MATCH) {
+        if (!moves)
+          return false;
+        toParse++;
+        continue;
+      }
+    }
+    if (eng != EEngine::TREE ? lowParse<SRegCode>(ctx, ctx.code_stack, code.data(), nullptr, toParse)
+                                : lowParse<SRegInfo>(ctx, ctx.stack, tree_root, nullptr, toParse))
       return true;
-    if (!positionMoves)
+    if (ctx.stepLimitReached) {
+      if (stepLimitHits++ == 0)
+        COLORER_LOG_WARN("RE '%' exceeded the limit of % backtracking steps", source, ctx.stepLimit);
+      return false;
+    }
+    if (!moves)
       return false;
-    toParse = ++pos;
-  } while (toParse <= end);
+    toParse++;
+  } while (toParse <= ctx.end);
   return false;
 }
 
@@ -1456,23 +2080,30 @@ bool CRegExp::parse(const UnicodeString* str, int pos, int eol, SMatches* mtch
                     PMatchHash nmtch
 #endif
                     ,
-                    int soScheme, int posMoves)
+                    int soScheme, int posMoves) const
 {
-  bool nms = positionMoves;
-  if (posMoves != -1)
-    positionMoves = (posMoves != 0);
+  MatchContext& ctx = threadContext();
 #ifdef COLORERMODE
-  schemeStart = soScheme;
+  ctx.setBackTrace(backStr, backTrace);
 #endif
-  global_pattern = str;
-  end = eol;
-  matches = mtch;
 #ifdef NAMED_MATCHES_IN_HASH
-  namedMatches = nmtch;
+  ctx.namedMatches = nmtch;
+  return parse(str, pos, eol, mtch, &ctx, soScheme, posMoves);
+#else
+  return parse(str, pos, eol, mtch, &ctx, soScheme, posMoves);
 #endif
-  bool result = parseRE(pos);
-  positionMoves = nms;
-  return result;
+}
+
+bool CRegExp::parse(const UnicodeString* str, int pos, int eol, SMatches* mtch, MatchContext* ctx,
+                    int soScheme, int posMoves) const
+{
+#ifdef COLORERMODE
+  ctx->schemeStart = soScheme;
+#endif
+  ctx->global_pattern = str;
+  ctx->end = eol;
+  ctx->matches = mtch;
+  return parseRE(*ctx, pos, posMoves == -1 ? positionMoves : posMoves != 0);
 }
 
 bool CRegExp::parse(const UnicodeString* str, SMatches* mtch
@@ -1480,18 +2111,20 @@ bool CRegExp::parse(const UnicodeString* str, SMatches* mtch
                     ,
                     PMatchHash nmtch
 #endif
-)
+) const
 {
-  end = str->length();
-  global_pattern = str;
+  MatchContext& ctx = threadContext();
+  ctx.end = str->length();
+  ctx.global_pattern = str;
 #ifdef COLORERMODE
-  schemeStart = 0;
+  ctx.schemeStart = 0;
+  ctx.setBackTrace(backStr, backTrace);
 #endif
-  matches = mtch;
+  ctx.matches = mtch;
 #ifdef NAMED_MATCHES_IN_HASH
-  namedMatches = nmtch;
+  ctx.namedMatches = nmtch;
 #endif
-  return parseRE(0);
+  return parseRE(ctx, 0, positionMoves);
 }
 
 /////////////////////////////////////////////////////////////////
@@ -1500,6 +2133,7 @@ bool CRegExp::parse(const UnicodeString* str, SMatches* mtch
 bool CRegExp::setRE(const UnicodeString* re)
 {
   error = EError::EERROR;
+  source = *re;
 #ifdef NAMED_MATCHES_IN_HASH
   PMatchHash oldnamedMatches = namedMatches;
   SMatchHash tmpMatchHash;
@@ -1511,11 +2145,11 @@ bool CRegExp::setRE(const UnicodeString* re)
 #endif
   return error == EError::EOK;
 }
-bool CRegExp::isOk()
+bool CRegExp::isOk() const
 {
   return error == EError::EOK;
 }
-EError CRegExp::getError()
+EError CRegExp::getError() const
 {
   return error;
 }
@@ -1526,22 +2160,100 @@ bool CRegExp::setPositionMoves(bool moves)
   return true;
 }
 
+MatchContext& CRegExp::threadContext()
+{
+  static thread_local MatchContext context;
+  return context;
+}
+
 void CRegExp::clearRegExpStack()
 {
-  CRegExp::RegExpStack_Size = 0;
-  delete[] CRegExp::RegExpStack;
-  CRegExp::RegExpStack = nullptr;
+  threadContext().stack.clear();
+  threadContext().code_stack.clear();
+}
+
+void CRegExp::setEngine(EEngine eng)
+{
+  engine.store(eng, std::memory_order_relaxed);
+}
+
+EEngine CRegExp::getEngine()
+{
+  return engine.load(std::memory_order_relaxed);
+}
+
+void CRegExp::setStepLimit(int limit)
+{
+  stepLimit.store(limit, std::memory_order_relaxed);
+}
+
+int CRegExp::getStepLimit()
+{
+  return stepLimit.load(std::memory_order_relaxed);
+}
+
+int CRegExp::getStepLimitHits() const
+{
+  return stepLimitHits;
+}
+
+const UnicodeString& CRegExp::getSource() const
+{
+  return source;
+}
+
+std::unique_ptr<CharacterClass> CRegExp::getFirstChars() const
+{
+  if (!tree_root)
+    return nullptr;
+  auto cc = std::make_unique<CharacterClass>();
+  bool any = false;
+  if (addFirstChars(tree_root, *cc, any) || any)
+    return nullptr;
+  cc->freeze();
+  return cc;
+}
+
+size_t CRegExp::getCompiledSize() const
+{
+  size_t size = sizeof(CRegExp) + nodes_count * sizeof(SRegInfo) + code.capacity() * sizeof(SRegCode);
+  if (firstClass)
+    size += sizeof(CharacterClass);
+  if (dfa)
+    size += dfa->getProgramSize();
+  return size;
+}
+
+#ifdef COLORERMODE
+bool CRegExp::hasBackTrace() const
+{
+  return backTraced;
+}
+#endif
+
+int CRegExp::getBracketsCount() const
+{
+  return cMatch;
+}
+
+int CRegExp::getNamedBracketsCount() const
+{
+#ifndef NAMED_MATCHES_IN_HASH
+  return cnMatch;
+#else
+  return 0;
+#endif
 }
 
 #ifndef NAMED_MATCHES_IN_HASH
-int CRegExp::getBracketNo(const UnicodeString* brname)
+int CRegExp::getBracketNo(const UnicodeString* brname) const
 {
   for (int brn = 0; brn < cnMatch; brn++)
     if (UStr::caseCompare(*brname,*brnames[brn])==0)
       return brn;
   return -1;
 }
-UnicodeString* CRegExp::getBracketName(int no)
+UnicodeString* CRegExp::getBracketName(int no) const
 {
   if (no >= cnMatch)
     return nullptr;
@@ -1561,11 +2273,23 @@ bool CRegExp::setBackTrace(const UnicodeString* str, SMatches* trace)
   backStr = str;
   return true;
 }
-bool CRegExp::getBackTrace(const UnicodeString** str, SMatches** trace)
+bool CRegExp::getBackTrace(const UnicodeString** str, SMatches** trace) const
 {
   *str = backStr;
   *trace = backTrace;
   return true;
 }
 
+void MatchContext::setBackTrace(const UnicodeString* str, const SMatches* trace)
+{
+  backStr = str;
+  backTrace = trace;
+}
+
+void MatchContext::getBackTrace(const UnicodeString** str, const SMatches** trace) const
+{
+  *str = backStr;
+  *trace = backTrace;
+}
+
 #endif
@@ -2,6 +2,9 @@
 #define COLORER_CREGEXP_H
 
 #include "colorer/Common.h"
+#include <atomic>
+#include <memory>
+#include <vector>
 
 /**
     @addtogroup cregexp Regular Expressions
@@ -27,6 +30,9 @@
 /// numeric matches num
 #define MATCHES_NUM 0x10
 
+/// max number of character ranges, used for vectorized search of the match start
+#define SCAN_RANGES_NUM 6
+
 #if !defined NAMED_MATCHES_IN_HASH
 // number of named brackets (access through SMatches.ns)
 #define NAMED_MATCHES_NUM 0x10
@@ -75,6 +81,7 @@ enum class EOps {
   ReMetaSymb,       // \W \s \d ...
   ReSymb,           // a b c ...
   ReWord,           // word...
+  ReFoldWord,       // word with /i, folded at compile time, only in the compiled program
   ReEnum,           // []
   ReNEnum,          // [^]
   ReBrackets,       // (...)
@@ -118,7 +125,19 @@ enum class EMetaSymbols {
 
 enum class EError { EOK = 0, EERROR, ESYNTAX, EBRACKETS, EENUM, EOP };
 
-/// @ingroup cregexp
+/// matching engines of CRegExp
+enum class EEngine {
+  TREE,      // walks the SRegInfo tree
+  BYTECODE,  // runs the flat SRegCode program
+  DFA        // runs LazyDfa for regular REs and SRegCode program for others
+};
+
+class LazyDfa;
+
+/** Match result of RE.
+    CRegExp::parse() fills only the brackets of RE, so the record doesn't need to be initialized.
+    @ingroup cregexp
+*/
 struct SMatches
 {
   int s[MATCHES_NUM];
@@ -131,7 +150,34 @@ struct SMatches
 #endif
 };
 
+/** Match result, which keeps only the brackets of RE, to be stored for a long time.
+    SMatches is restored from it to be used as the back trace.
+    @ingroup cregexp
+*/
+class CompactMatches
+{
+ public:
+  CompactMatches() = default;
+  explicit CompactMatches(const SMatches& match);
+
+  void store(const SMatches& match);
+  /**
+    Fills the brackets of @c match, which are kept in the record.
+  */
+  void restore(SMatches& match) const;
+  bool operator==(const CompactMatches& other) const;
+
+ private:
+  // start and end positions of the numeric brackets, then of the named ones
+  std::unique_ptr<int[]> positions;
+  int cMatch = 0;
+  int cnMatch = 0;
+};
+
 /** Regular expressions internal tree node.
+    Node is not changed while matching, match data is kept in SRegState and MatchContext.
+    Back trace of parse() calls without MatchContext is kept in CRegExp object,
+    and CRegExp::setBackTrace() changes it for all threads, which share the RE.
     @ingroup cregexp
 */
 class SRegInfo
@@ -153,20 +199,88 @@ class SRegInfo
   SRegInfo* parent = nullptr;
   SRegInfo* next = nullptr;
   SRegInfo* prev = nullptr;
-  int oldParse = 0;
   int param0 = 0;
-  int param1 = 0;
   int s = 0;
   int e = 0;
+  // index of the node state in MatchContext
+  int id = 0;
 
   EOps op = EOps::ReEmpty;
+
+  [[nodiscard]] const SRegInfo* getNext() const
+  {
+    return next;
+  }
+  [[nodiscard]] const SRegInfo* getParent() const
+  {
+    return parent;
+  }
+  [[nodiscard]] const SRegInfo* getParam() const
+  {
+    return un.param;
+  }
+};
+
+/** Compiled RE program instruction.
+    Program is the RE tree, stored in one array in the order of node ids (preorder).
+    So the operand of the block operator is the next instruction, and links to
+    the next and parent nodes are relative offsets inside the array.
+    @ingroup cregexp
+*/
+struct SRegCode
+{
+  union {
+    EMetaSymbols metaSymbol;
+    UChar symbol;
+    const UnicodeString* word;
+    const CharacterClass* charclass;
+  } un;
+#if defined NAMED_MATCHES_IN_HASH
+  const UnicodeString* namedata;
+#endif
+  // offsets of the next and parent instructions, 0 if there is no such node
+  int next;
+  int parent;
+  int param0;
+  int s;
+  int e;
+  int id;
+
+  EOps op;
+
+  [[nodiscard]] const SRegCode* getNext() const
+  {
+    return next ? this + next : nullptr;
+  }
+  [[nodiscard]] const SRegCode* getParent() const
+  {
+    return parent ? this + parent : nullptr;
+  }
+  [[nodiscard]] const SRegCode* getParam() const
+  {
+    return this + 1;
+  }
 };
 
+/** Mutable state of the RE tree node, used while matching.
+    @ingroup cregexp
+*/
+struct SRegState
+{
+  // bracket start position
+  int s;
+  int oldParse;
+  // repeat counters
+  int param0;
+  int param1;
+};
+
+template <class Node>
 struct StackElem
 {
   // local variable
-  SRegInfo* re;
-  SRegInfo* prev;
+  const Node* re;
+  const Node* prev;
   int toParse;
   bool leftenter;
   // step if function return true
@@ -177,6 +291,63 @@ struct StackElem
 
 #define INIT_MEM_SIZE 512
 #define MEM_INC 128
+/// default limit of backtracking steps at one start position of CRegExp::parse() call
+#define STEP_LIMIT_DEFAULT 1000000
+
+/** Backtracking stack of the regexp matcher.
+    Each thread, which runs CRegExp matching, owns its own instance,
+    so different CRegExp objects could be used concurrently.
+    @ingroup cregexp
+*/
+template <class Node>
+class RegExpStack
+{
+ public:
+  StackElem<Node>& push()
+  {
+    if (count == static_cast<int>(elems.size())) {
+      elems.resize(elems.empty() ? INIT_MEM_SIZE : elems.size() + MEM_INC);
+    }
+    steps++;
+    return elems[count++];
+  }
+  StackElem<Node>& pop()
+  {
+    return elems[--count];
+  }
+  [[nodiscard]] bool empty() const
+  {
+    return count == 0;
+  }
+  /**
+    Returns count of backtracking steps (pushed elements) since the last reset.
+  */
+  [[nodiscard]] int getSteps() const
+  {
+    return steps;
+  }
+  /**
+    Drops all elements and resets the step counter.
+  */
+  void reset()
+  {
+    count = 0;
+    steps = 0;
+  }
+  /**
+    Releases stack memory.
+  */
+  void clear()
+  {
+    count = 0;
+    std::vector<StackElem<Node>>().swap(elems);
+  }
+
+ private:
+  std::vector<StackElem<Node>> elems;
+  int count = 0;
+  int steps = 0;
+};
 
 enum ReAction {
   rea_False = 0,
@@ -189,6 +360,58 @@ enum ReAction {
   rea_NGRangeNM_step2,
   rea_NGRangeNM_step3
 };
+
+/** Match state of regular expressions.
+    Keeps all the data, which is changed while CRegExp matching: input string, matches,
+    back trace and the backtracking stack. CRegExp object itself is not changed by parse()
+    with the context, so the same compiled RE could be used concurrently, if every thread
+    passes its own MatchContext with its own back trace into CRegExp::parse().
+    CRegExp::setBackTrace() changes the RE object and must not be used on the shared RE.
+    Context could be reused for any number of sequential matches with any RE objects.
+    @ingroup cregexp
+*/
+class MatchContext
+{
+ public:
+  MatchContext() = default;
+
+#ifdef COLORERMODE
+  /**
+    Changes string and matches of another RE, used for backreferences with \y \Y operators.
+  */
+  void setBackTrace(const UnicodeString* str, const SMatches* trace);
+  /**
+    Returns current string and matches, used for backreferences with \y \Y operators.
+  */
+  void getBackTrace(const UnicodeString** str, const SMatches** trace) const;
+#endif
+
+ private:
+  friend class CRegExp;
+
+  const UnicodeString* global_pattern = nullptr;
+  int end = 0;
+  SMatches* matches = nullptr;
+#ifdef NAMED_MATCHES_IN_HASH
+  SMatchHash* namedMatches = nullptr;
+#endif
+#ifdef COLORERMODE
+  const UnicodeString* backStr = nullptr;
+  const SMatches* backTrace = nullptr;
+  int schemeStart = 0;
+#endif
+  bool startChange = false;
+  bool endChange = false;
+  // matching was stopped by the step limit
+  bool stepLimitReached = false;
+  // limit of backtracking steps, taken at the start of the parse
+  int stepLimit = 0;
+
+  std::vector<SRegState> states;
+  RegExpStack<SRegInfo> stack;
+  RegExpStack<SRegCode> code_stack;
+};
+
 /** Regular Expression compiler and matcher.
     Colorer regular expressions library cregexp.
 
@@ -262,12 +485,12 @@ class CRegExp
   /**
     Is compilied RE well-formed.
   */
-  bool isOk();
+  bool isOk() const;
 
   /**
     Returns information about RE compilation error.
   */
-  EError getError();
+  EError getError() const;
 
   /**
     Tells RE parser, that it must make moves on tested string while RE matching.
@@ -276,22 +499,72 @@ class CRegExp
   /**
     Returns count of named brackets.
   */
-  int getBracketNo(const UnicodeString* brname);
+  int getBracketNo(const UnicodeString* brname) const;
+  /**
+    Returns count of numeric brackets, including the whole match.
+  */
+  int getBracketsCount() const;
+  /**
+    Returns count of named brackets.
+  */
+  int getNamedBracketsCount() const;
   /**
     Returns named bracked name by it's index.
   */
-  UnicodeString* getBracketName(int no);
+  UnicodeString* getBracketName(int no) const;
 #ifdef COLORERMODE
   bool setBackRE(CRegExp* bkre);
   /**
     Changes RE object, used for backreferences with named \y{} \Y{} operators.
+    Back trace is used only by parse() calls without MatchContext,
+    otherwise it is taken from the context. This method changes RE object,
+    so it must not be called, while other threads match with the same RE.
   */
   bool setBackTrace(const UnicodeString* str, SMatches* trace);
   /**
     Returns current RE object, used for backreferences with \y \Y operators.
   */
-  bool getBackTrace(const UnicodeString** str, SMatches** trace);
+  bool getBackTrace(const UnicodeString** str, SMatches** trace) const;
 #endif
+  /**
+    Selects matching engine for all RE objects.
+    All engines give the same results, RE tree is kept to compare them.
+    Should be called before any matching is started, parse() calls of other threads
+    keep the engine, which was selected at their start.
+  */
+  static void setEngine(EEngine eng);
+  static EEngine getEngine();
+  /**
+    Sets the limit of backtracking steps at one start position of parse() call for all RE objects,
+    0 - no limit.
+    When the limit is reached, parse() returns false and the RE is reported in the log.
+    The limit is taken at the start of each parse() call.
+  */
+  static void setStepLimit(int limit);
+  static int getStepLimit();
+  /**
+    Returns count of parse() calls of this RE, which were stopped by the step limit.
+  */
+  int getStepLimitHits() const;
+  /**
+    Returns source text of RE.
+  */
+  const UnicodeString& getSource() const;
+#ifdef COLORERMODE
+  /**
+    Checks, that RE references the brackets of the back RE with \y or \Y.
+  */
+  bool hasBackTrace() const;
+#endif
+  /**
+    Returns all characters, which could start the match,
+    nullptr if the match could be empty or could start with any character.
+  */
+  std::unique_ptr<CharacterClass> getFirstChars() const;
+  /**
+    Returns estimated memory size of compiled RE in bytes.
+  */
+  size_t getCompiledSize() const;
   /**
     Compiles specified regular expression and drops all
     previous structures.
@@ -300,43 +573,71 @@ class CRegExp
 #ifdef NAMED_MATCHES_IN_HASH
   /** Runs RE parser against input string @c str
    */
-  bool parse(const UnicodeString* str, SMatches* mtch, SMatchHash* nmtch = nullptr);
+  bool parse(const UnicodeString* str, SMatches* mtch, SMatchHash* nmtch = nullptr) const;
   /** Runs RE parser against input string @c str
    */
   bool parse(const UnicodeString* str, int pos, int eol, SMatches* mtch,
-             SMatchHash* nmtch = nullptr, int soscheme = 0, int moves = -1);
+             SMatchHash* nmtch = nullptr, int soscheme = 0, int moves = -1) const;
 #else
   /** Runs RE parser against input string @c str
    */
-  bool parse(const UnicodeString* str, SMatches* mtch);
-  /** Runs RE parser against input string @c str
+  bool parse(const UnicodeString* str, SMatches* mtch) const;
+  /** Runs RE parser against input string @c str.
+      Uses match context of the calling thread and back trace of this object.
    */
   bool parse(const UnicodeString* str, int pos, int eol, SMatches* mtch, int soscheme = 0,
-             int moves = -1);
+             int moves = -1) const;
+  /** Runs RE parser against input string @c str with the match context @c ctx.
+      This method doesn't change RE object and could be called concurrently
+      with different contexts.
+   */
+  bool parse(const UnicodeString* str, int pos, int eol, SMatches* mtch, MatchContext* ctx,
+             int soscheme = 0, int moves = -1) const;
 #endif
 
  private:
+  // source text of RE, used in diagnostics
+  UnicodeString source;
   bool ignoreCase = false;
   bool extend = false;
   bool positionMoves = false;
   bool singleLine = false;
   bool multiLine = false;
   SRegInfo* tree_root = nullptr;
+  // count of tree nodes, the size of node states in MatchContext
+  int nodes_count = 0;
+  // RE tree, compiled into the flat program
+  std::vector<SRegCode> code;
+  // words of the program, folded for /i
+  std::vector<std::unique_ptr<UnicodeString>> foldedWords;
+  // see getFoldTable(), set for /i
+  const UChar* foldTable = nullptr;
+  // DFA of RE, nullptr if RE is not regular
+  std::unique_ptr<LazyDfa> dfa;
   EError error = EError::EOK;
   UChar firstChar = 0;
   EMetaSymbols firstMetaChar = EMetaSymbols::ReBadMeta;
+  // literal, which starts every match
+  UnicodeString firstWord;
+  // all possible first characters of the match, nullptr if the match could be empty
+  std::unique_ptr<CharacterClass> firstClass;
+  // literal, which is contained in every match
+  UnicodeString requiredWord;
+#ifdef COLORER_FEATURE_ICU
+  // firstClass or first char of firstWord as ranges of UTF-16 units
+  UChar scanRanges[SCAN_RANGES_NUM][2] = {};
+  int scanRangesCount = 0;
+#endif
 #ifdef COLORERMODE
   CRegExp* backRE = nullptr;
   const UnicodeString* backStr = nullptr;
   SMatches* backTrace = nullptr;
-  int schemeStart = 0;
+  bool backTraced = false;
 #endif
-  bool startChange = false;
-  bool endChange = false;
-  const UnicodeString* global_pattern = nullptr;
-  int end = 0;
 
-  SMatches* matches = nullptr;
+  // count of parse() calls, stopped by the step limit
+  mutable std::atomic<int> stepLimitHits {0};
+
   int cMatch = 0;
 #if !defined NAMED_MATCHES_IN_HASH
   UnicodeString* brnames[NAMED_MATCHES_NUM] = {};
@@ -348,25 +649,50 @@ class CRegExp
   void init();
   EError setRELow(const UnicodeString& re);
   EError setStructs(SRegInfo*&, const UnicodeString& expr, int& endPos);
+  int enumerateNodes(SRegInfo* re, int id);
+  void compile();
+  void compileNodes(const SRegInfo* re);
 
   void optimize();
-  bool quickCheck(int toParse);
-  bool isWordBoundary(int toParse);
-  bool isNWordBoundary(int toParse);
-  bool checkMetaSymbol(EMetaSymbols metaSymbol, int& toParse);
-  bool lowParse(SRegInfo* re, SRegInfo* prev, int toParse);
-  bool parseRE(int toParse);
-
-  int count_elem;
-  void check_stack(bool res, SRegInfo** re, SRegInfo** prev, int* toParse, bool* leftenter,
-                   int* action);
-  void insert_stack(SRegInfo** re, SRegInfo** prev, int* toParse, bool* leftenter, int ifTrueReturn,
-                    int ifFalseReturn, SRegInfo** re2, SRegInfo** prev2, int toParse2);
-
-  static StackElem* RegExpStack;
-  static int RegExpStack_Size;
+  bool addFirstChars(const SRegInfo* re, CharacterClass& cc, bool& any) const;
+  bool addFirstWord(const SRegInfo* re, UnicodeString& word) const;
+  void findRequiredWord(const SRegInfo* re, UnicodeString& word) const;
+  bool checkFirst(const MatchContext& ctx, int toParse) const;
+  int findFirst(const MatchContext& ctx, int toParse) const;
+  bool quickCheck(const MatchContext& ctx, int toParse) const;
+  bool isWordBoundary(const MatchContext& ctx, int toParse) const;
+  bool isNWordBoundary(const MatchContext& ctx, int toParse) const;
+  bool checkMetaSymbol(MatchContext& ctx, EMetaSymbols metaSymbol, int& toParse) const;
+  template <class Node>
+  bool lowParse(MatchContext& ctx, RegExpStack<Node>& stack, const Node* re, const Node* prev,
+                int toParse) const;
+  bool parseRE(MatchContext& ctx, int toParse, bool moves) const;
+
+  template <class Node>
+  static void check_stack(RegExpStack<Node>& stack, bool res, const Node** re, const Node** prev,
+                          int* toParse, bool* leftenter, int* action);
+  template <class Node>
+  static void insert_stack(RegExpStack<Node>& stack, const Node** re, const Node** prev, int* toParse,
+                           bool* leftenter, int ifTrueReturn, int ifFalseReturn, const Node* re2,
+                           const Node* prev2, int toParse2);
+
+  // changed by any thread, while other threads match
+  static std::atomic<EEngine> engine;
+  static std::atomic<int> stepLimit;
+
+  /**
+    Match context of the calling thread, used by parse() calls without context.
+  */
+  static MatchContext& threadContext();
+  /**
+    Table of Character::foldCase() for all UTF-16 units, built on the first call.
+  */
+  static const UChar* getFoldTable();
 
  public:
+  /**
+    Releases backtracking stack memory of the calling thread.
+  */
   static void clearRegExpStack();
 };
 
@@ -22,6 +22,9 @@ BaseEditor::BaseEditor(ParserFactory* parserFactory_, LineSource* lineSource_)
   lrSupport = nullptr;
 
   invalidLine = 0;
+  changedFrom = changedTo = -1;
+  textChanged = false;
+  appendMode = false;
   backParse = -1;
   lineCount = 0;
   wStart = 0;
@@ -103,6 +106,8 @@ void BaseEditor::remapLRS(bool recreate)
   lrSupport->setRegionMapper(regionMapper);
   lrSupport->setSpecialRegion(def_Special);
   invalidLine = 0;
+  changedFrom = -1;
+  textChanged = false;
   rd_def_Text = rd_def_HorzCross = rd_def_VertCross = nullptr;
   if (regionMapper != nullptr) {
     rd_def_Text = regionMapper->getRegionDefine("def:Text");
@@ -111,6 +116,26 @@ void BaseEditor::remapLRS(bool recreate)
   }
 }
 
+void BaseEditor::setAppendMode(bool append, int window)
+{
+  appendMode = append;
+  if (!append) {
+    // regions are rearranged by the next validate(), as for the new window size
+    lrSize = 0;
+    return;
+  }
+  lrSize = window > 0 ? window : wSize * 2;
+  lrSupport->resize(lrSize);
+  lrSupport->clear();
+  int firstLine = lineCount > lrSize ? lineCount - lrSize : 0;
+  lrSupport->setFirstLine(firstLine);
+  /* Regions of the parsed lines are read from the cache */
+  int readTo = invalidLine < lineCount ? invalidLine : lineCount;
+  if (readTo > firstLine) {
+    textParser->parse(firstLine, readTo - firstLine, TextParser::TextParseMode::TPM_CACHE_READ);
+  }
+}
+
 void BaseEditor::setFileType(FileType* ftype)
 {
   COLORER_LOG_DEBUG("[BaseEditor] setFileType: %", ftype->getName());
@@ -118,6 +143,8 @@ void BaseEditor::setFileType(FileType* ftype)
   parserFactory->getHrcLibrary().loadFileType(ftype);
   textParser->setFileType(currentFileType);
   invalidLine = 0;
+  changedFrom = -1;
+  textChanged = false;
 }
 
 FileType* BaseEditor::setFileType(const UnicodeString& fileType)
@@ -332,6 +359,9 @@ LineRegion* BaseEditor::getLineRegions(int lno)
 void BaseEditor::modifyEvent(int topLine)
 {
   COLORER_LOG_DEBUG("[BaseEditor] modifyEvent: %", topLine);
+  // the following text is changed, the old parser state can't be reused
+  changedFrom = -1;
+  textChanged = true;
   if (invalidLine > topLine) {
     invalidLine = topLine;
     for (auto& editorListener : editorListeners) {
@@ -342,9 +372,48 @@ void BaseEditor::modifyEvent(int topLine)
 
 void BaseEditor::modifyLineEvent(int line)
 {
+  COLORER_LOG_DEBUG("[BaseEditor] modifyLineEvent: %", line);
   if (invalidLine > line) {
+    // the old cache after the line is not valid, until the text, changed by modifyEvent, is parsed
+    if (!textChanged) {
+      if (changedFrom != invalidLine) {
+        changedTo = line;
+      }
+      changedFrom = line;
+    }
     invalidLine = line;
   }
+  else if (changedFrom == invalidLine && line > changedTo) {
+    changedTo = line;
+  }
+}
+
+bool BaseEditor::saveParseCache(std::ostream& out)
+{
+  return textParser->saveCache(out);
+}
+
+bool BaseEditor::loadParseCache(std::istream& in)
+{
+  int lines = textParser->loadCache(in);
+  COLORER_LOG_DEBUG("[BaseEditor] loadParseCache: %", lines);
+  if (lines == 0) {
+    return false;
+  }
+  invalidLine = lines;
+  changedFrom = -1;
+  textChanged = false;
+  /* Regions of the current lines are read from the new cache */
+  int parseFrom = (int) lrSupport->getFirstLine();
+  int parseTo = parseFrom + lrSize;
+  if (parseTo > lines) {
+    parseTo = lines;
+  }
+  lrSupport->clear();
+  if (parseTo > parseFrom) {
+    textParser->parse(parseFrom, parseTo - parseFrom, TextParser::TextParseMode::TPM_CACHE_READ);
+  }
+  return true;
 }
 
 void BaseEditor::visibleTextEvent(int wStart_, int wSize_)
@@ -376,6 +445,10 @@ void BaseEditor::validate(int lno, bool rebuildRegions)
   if (lno == -1 || lno > lineCount) {
     lno = lineCount - 1;
   }
+  if (appendMode) {
+    validateAppended(lno);
+    return;
+  }
 
   size_t firstLine = lrSupport->getFirstLine();
   parseFrom = parseTo = (wStart + wSize);
@@ -446,15 +519,70 @@ void BaseEditor::validate(int lno, bool rebuildRegions)
   if (parseTo - parseFrom > 0) {
     COLORER_LOG_DEBUG("[BaseEditor] validate:parse:%-%, %", parseFrom, parseTo,
                   tpmode == TextParser::TextParseMode::TPM_CACHE_READ ? "READ" : "UPDATE");
-    int stopLine = textParser->parse(parseFrom, parseTo - parseFrom, tpmode);
-
-    if (tpmode == TextParser::TextParseMode::TPM_CACHE_UPDATE) {
+    if (tpmode == TextParser::TextParseMode::TPM_CACHE_UPDATE && parseFrom == changedFrom) {
+      int damagedEnd;
+      int stopLine = textParser->reparseLines(changedFrom, changedTo, parseTo - parseFrom, &damagedEnd);
+      changedFrom = -1;
+      textChanged = false;
       invalidLine = stopLine + 1;
+      COLORER_LOG_DEBUG("[BaseEditor] validate:reparsed: damaged=%-%, invalidLine=%", parseFrom,
+                    damagedEnd, invalidLine);
+      /* Regions of the rest of unchanged lines are dropped with layout */
+      int readTo = invalidLine < parseTo ? invalidLine : parseTo;
+      if (layoutChanged && readTo > damagedEnd + 1) {
+        textParser->parse(damagedEnd + 1, readTo - damagedEnd - 1, TextParser::TextParseMode::TPM_CACHE_READ);
+      }
+      if (invalidLine < parseTo) {
+        stopLine = textParser->parse(invalidLine, parseTo - invalidLine, tpmode);
+        invalidLine = stopLine + 1;
+      }
+    }
+    else {
+      int stopLine = textParser->parse(parseFrom, parseTo - parseFrom, tpmode);
+
+      if (tpmode == TextParser::TextParseMode::TPM_CACHE_UPDATE) {
+        changedFrom = -1;
+        textChanged = false;
+        invalidLine = stopLine + 1;
+      }
     }
     COLORER_LOG_DEBUG("[BaseEditor] validate:parsed: invalidLine=%", invalidLine);
   }
 }
 
+/** Parses the text up to the line in the append mode.
+    The window of regions is moved to the end of the text before the parse.
+*/
+void BaseEditor::validateAppended(int lno)
+{
+  int firstLine = lineCount > lrSize ? lineCount - lrSize : 0;
+  if (firstLine < (int) lrSupport->getFirstLine()) {
+    /* The text is shortened, regions of the new window are read again */
+    lrSupport->clear();
+    lrSupport->setFirstLine(firstLine);
+    int readTo = invalidLine < lineCount ? invalidLine : lineCount;
+    if (readTo > firstLine) {
+      textParser->parse(firstLine, readTo - firstLine, TextParser::TextParseMode::TPM_CACHE_READ);
+    }
+  }
+  else {
+    // lines before the window are dropped, slots of their regions are reused by new lines
+    lrSupport->setFirstLine(firstLine);
+  }
+
+  int parseTo = lno + 1;
+  if (parseTo > lineCount) {
+    parseTo = lineCount;
+  }
+  if (parseTo > invalidLine) {
+    COLORER_LOG_DEBUG("[BaseEditor] validateAppended:parse:%-%", invalidLine, parseTo);
+    int stopLine = textParser->parse(invalidLine, parseTo - invalidLine, TextParser::TextParseMode::TPM_CACHE_APPEND);
+    changedFrom = -1;
+    textChanged = false;
+    invalidLine = stopLine + 1;
+  }
+}
+
 void BaseEditor::idleJob(int time)
 {
   if (invalidLine < lineCount) {
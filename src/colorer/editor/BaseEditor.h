@@ -72,6 +72,18 @@ class BaseEditor : public RegionHandler
    */
   void setBackParse(int _backParse);
 
+  /**
+   * Sets the mode for the text, which grows only at its end, like logs.
+   * Lines, added by lineCountEvent(), are parsed from the parser state,
+   * kept after the last parsed line. Regions are stored only for the last
+   * @c window lines of the text, getLineRegions() returns null for other lines.
+   * Modifications of the parsed text are processed, as in usual mode.
+   * @param append Enables or disables the mode.
+   * @param window Number of last lines with regions. If <= 0, dropped into default
+   * value.
+   */
+  void setAppendMode(bool append, int window);
+
   /**
    * Initial HRC type, used for parse processing.
    * If changed during processing, all text information
@@ -198,11 +210,27 @@ class BaseEditor : public RegionHandler
    * Generally, this type of event can be processed much faster
    * because of pre-checking line's changed structure and
    * cancelling further parsing in case of unmodified text structure.
+   * The number of lines must stay the same, otherwise modifyEvent is used.
+   * Parsing of modified lines stops at the first following line,
+   * where the parser state is the same, as it was before the modification.
    * @param line Modified line of text.
-   * @todo Not used yet! This must include special 'try' parse method.
    */
   void modifyLineEvent(int line);
 
+  /**
+   * Writes the parse cache of the text into the binary stream.
+   * @see TextParser::saveCache
+   */
+  bool saveParseCache(std::ostream& out);
+
+  /**
+   * Reads the parse cache of the text, which is not changed since the cache was written.
+   * Lines, covered by the cache, are not parsed again.
+   * @return true, if the cache is read.
+   * @see TextParser::loadCache
+   */
+  bool loadParseCache(std::istream& in);
+
   /**
    * Informs about changes in visible range of text lines.
    * This information is used to make assumptions about
@@ -268,6 +296,12 @@ class BaseEditor : public RegionHandler
   int lrSize;
   // position of last validLine
   int invalidLine;
+  // range of lines, modified by modifyLineEvent after invalidLine, or -1
+  int changedFrom, changedTo;
+  // text after invalidLine is changed by modifyEvent, the range is not started until the next parse
+  bool textChanged;
+  // the text grows at the end, regions are kept for the last lrSize lines
+  bool appendMode;
 
  public:
   int getInvalidLine() const;
@@ -278,6 +312,7 @@ class BaseEditor : public RegionHandler
 
   inline int getLastVisibleLine();
   void remapLRS(bool recreate);
+  void validateAppended(int lno);
   /**
    * Searches for the paired token and creates PairMatch
    * object with valid initial properties filled.
@@ -96,6 +96,8 @@ void LineRegionsSupport::startParsing(size_t /*lno*/)
   }
   schemeStack.clear();
   schemeStack.push_back(&background);
+  // schemes, which are open before the first line, do not change the regions of the previous lines
+  flowBackground = nullptr;
 }
 
 void LineRegionsSupport::clearLine(size_t lno, UnicodeString* /*line*/)
@@ -171,7 +173,9 @@ void LineRegionsSupport::enterScheme(size_t line_no, UnicodeString* /*line*/, in
   // we must skip transparent regions
   if (lr->region != nullptr) {
     auto* lr_add = new LineRegion(*lr);
-    flowBackground->end = lr_add->start;
+    if (flowBackground != nullptr) {
+      flowBackground->end = lr_add->start;
+    }
     flowBackground = lr_add;
     addLineRegion(line_no, lr_add);
   }
@@ -30,3 +30,8 @@ void StreamWriter::write(UChar c)
   int bufLen = Encodings::toUTF8Bytes(c, buf);
   for (int pos = 0; pos < bufLen; pos++) putc(buf[pos], file);
 }
+
+void StreamWriter::flush()
+{
+  fflush(file);
+}
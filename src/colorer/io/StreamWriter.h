@@ -18,6 +18,7 @@ class StreamWriter : public Writer
   StreamWriter(FILE* fstream, bool _useBOM);
   ~StreamWriter() override = default;
   void write(UChar c) override;
+  void flush() override;
 
  protected:
   StreamWriter() = default;
@@ -19,3 +19,5 @@ void Writer::write(const UnicodeString* string, int from, int num)
 {
   write(*string, from, num);
 }
+
+void Writer::flush() {}
@@ -21,6 +21,8 @@ class Writer
   virtual void write(const UnicodeString* string, int from, int num);
   /** Writes single character */
   virtual void write(UChar c) = 0;
+  /** Passes the written data into the output, if it is buffered */
+  virtual void flush();
 
   Writer(Writer&&) = delete;
   Writer(const Writer&) = delete;
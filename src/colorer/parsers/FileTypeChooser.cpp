@@ -1,7 +1,7 @@
 #include "colorer/parsers/FileTypeChooser.h"
 
-FileTypeChooser::FileTypeChooser(const ChooserType type, const double priority, CRegExp* re)
-    : m_type {type}, m_priority {priority}, m_reg_matcher {re}
+FileTypeChooser::FileTypeChooser(const ChooserType type, const double priority, std::shared_ptr<CRegExp> re)
+    : m_type {type}, m_priority {priority}, m_reg_matcher {std::move(re)}
 {
 }
 
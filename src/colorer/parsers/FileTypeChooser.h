@@ -2,6 +2,7 @@
 #define COLORER_FILETYPECHOOSER_H
 
 #include "colorer/cregexp/cregexp.h"
+#include <memory>
 
 /** Stores regular expressions of filename and firstline
     elements and helps to detect file type.
@@ -17,7 +18,7 @@ class FileTypeChooser
       @param priority Priority of this rule
       @param re Associated regular expression
   */
-  FileTypeChooser(ChooserType type, double priority, CRegExp* re);
+  FileTypeChooser(ChooserType type, double priority, std::shared_ptr<CRegExp> re);
 
   /** Returns type of chooser */
   [[nodiscard]]
@@ -41,7 +42,7 @@ class FileTypeChooser
  private:
   ChooserType m_type;
   double m_priority;
-  std::unique_ptr<CRegExp> m_reg_matcher;
+  std::shared_ptr<CRegExp> m_reg_matcher;
 };
 
 #endif  // COLORER_FILETYPECHOOSER_H
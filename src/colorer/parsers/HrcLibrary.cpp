@@ -48,6 +48,11 @@ const Region* HrcLibrary::getRegion(const UnicodeString* name)
   return pimpl->getRegion(name);
 }
 
+RegExpCacheStats HrcLibrary::getRegExpCacheStats() const
+{
+  return pimpl->getRegExpCacheStats();
+}
+
 void HrcLibrary::loadFileType(FileType* filetype)
 {
   pimpl->loadFileType(filetype);
@@ -47,6 +47,9 @@ void HrcLibrary::Impl::loadSource(XmlInputSource* is)
     throw;
   }
   current_input_source = istemp;
+  if (!current_input_source) {
+    pruneRegExpCache();
+  }
 }
 
 void HrcLibrary::Impl::unloadFileType(const FileType* filetype)
@@ -70,6 +73,7 @@ void HrcLibrary::Impl::unloadFileType(const FileType* filetype)
   }
   fileTypeHash.erase(filetype->getName());
   delete filetype;
+  pruneRegExpCache();
 }
 
 void HrcLibrary::Impl::loadFileType(FileType* filetype)
@@ -299,8 +303,7 @@ void HrcLibrary::Impl::addPrototypeDetectParam(const XMLNode& elem, FileType* cu
     return;
   }
 
-  auto matchRE = std::make_unique<CRegExp>(&elem.text);
-  matchRE->setPositionMoves(true);
+  auto matchRE = compileRegExp(elem.text, true);
   if (!matchRE->isOk()) {
     COLORER_LOG_WARN("Fault compiling chooser RE '%' in prototype '%'", elem.text,
                      current_parse_prototype->pimpl->name);
@@ -329,7 +332,7 @@ void HrcLibrary::Impl::addPrototypeDetectParam(const XMLNode& elem, FileType* cu
           weight, current_parse_prototype->getName(), e.what(), current_input_source->getPath());
     }
   }
-  current_parse_prototype->pimpl->chooserVector.emplace_back(ctype, prior, matchRE.release());
+  current_parse_prototype->pimpl->chooserVector.emplace_back(ctype, prior, std::move(matchRE));
 }
 
 void HrcLibrary::Impl::addPrototypeParameters(const XMLNode& elem, FileType* current_parse_prototype)
@@ -498,6 +501,8 @@ void HrcLibrary::Impl::addScheme(const XMLNode& elem)
     return;
   }
   parseSchemeBlock(scheme, elem);
+  scheme->prefilter.build(scheme->nodes);
+  scheme->keywords.build(scheme->nodes);
 }
 
 void HrcLibrary::Impl::parseSchemeBlock(SchemeImpl* scheme, const XMLNode& elem)
@@ -572,7 +577,7 @@ void HrcLibrary::Impl::addSchemeRegexp(SchemeImpl* scheme, const XMLNode& elem)
   }
 
   const auto entMatchParam = useEntities(&matchParam);
-  auto regexp = std::make_unique<CRegExp>(entMatchParam.get());
+  auto regexp = compileRegExp(*entMatchParam, false);
   if (!regexp->isOk()) {
     COLORER_LOG_ERROR("fault compiling regexp '%' of scheme '%', skip this regexp block.", *entMatchParam,
                       *scheme->schemeName);
@@ -583,7 +588,6 @@ void HrcLibrary::Impl::addSchemeRegexp(SchemeImpl* scheme, const XMLNode& elem)
   const auto& dhrcRegexpAttrPriority = elem.getAttrValue(hrcRegexpAttrPriority);
   scheme_node->lowPriority = UnicodeString(value_low).compare(dhrcRegexpAttrPriority) == 0;
   scheme_node->start = std::move(regexp);
-  scheme_node->start->setPositionMoves(false);
 
   loadRegexpRegions(scheme_node.get(), elem);
   if (scheme_node->region) {
@@ -640,8 +644,7 @@ void HrcLibrary::Impl::addSchemeBlock(SchemeImpl* scheme, const XMLNode& elem)
   }
 
   const uUnicodeString startParam = useEntities(&start_param);
-  auto start_regexp = std::make_unique<CRegExp>(startParam.get());
-  start_regexp->setPositionMoves(false);
+  auto start_regexp = compileRegExp(*startParam, false);
   if (!start_regexp->isOk()) {
     COLORER_LOG_ERROR("fault compiling start regexp '%' in block of scheme '%', skip this block.", *startParam,
                       *scheme->schemeName);
@@ -649,10 +652,7 @@ void HrcLibrary::Impl::addSchemeBlock(SchemeImpl* scheme, const XMLNode& elem)
   }
 
   const uUnicodeString endParam = useEntities(&end_param);
-  auto end_regexp = std::make_unique<CRegExp>();
-  end_regexp->setPositionMoves(true);
-  end_regexp->setBackRE(start_regexp.get());
-  end_regexp->setRE(endParam.get());
+  auto end_regexp = compileRegExp(*endParam, true, start_regexp.get());
   if (!end_regexp->isOk()) {
     COLORER_LOG_ERROR("fault compiling end regexp '%' in block of scheme '%', skip this block.", *startParam,
                       *scheme->schemeName);
@@ -897,6 +897,13 @@ void HrcLibrary::Impl::updateLinks()
       }
     }
   }
+  // inherit links are final now, candidate lists could follow them
+  for (auto& scheme_it : schemeHash) {
+    SchemeImpl* scheme = scheme_it.second;
+    if (scheme->fileType->pimpl->loadDone) {
+      scheme->prefilter.link(scheme->nodes);
+    }
+  }
 }
 
 uUnicodeString HrcLibrary::Impl::qualifyOwnName(const UnicodeString& name) const
@@ -995,6 +1002,69 @@ uUnicodeString HrcLibrary::Impl::qualifyForeignName(const UnicodeString* name, c
   return nullptr;
 }
 
+std::shared_ptr<CRegExp> HrcLibrary::Impl::compileRegExp(const UnicodeString& pattern, bool moves,
+                                                        CRegExp* backRE)
+{
+  UnicodeString key(moves ? "m:" : "s:");
+  key.append(pattern);
+  // RE of the block end with back references is compiled with the bracket names of the start RE,
+  // so they are a part of its key. RE without back references is the same for any start RE.
+  UnicodeString back_key(key);
+  back_key.append(UnicodeString("\n"));
+  for (int i = 0; backRE && i < backRE->getNamedBracketsCount(); i++) {
+    back_key.append(*backRE->getBracketName(i)).append(UnicodeString(","));
+  }
+
+  auto regexp = findRegExp(key);
+  if (!regexp) {
+    regexp = findRegExp(back_key);
+  }
+  if (regexp) {
+    regExpCacheStats.hits++;
+    regExpCacheStats.bytesSaved += regexp->getCompiledSize();
+    return regexp;
+  }
+
+  regexp = std::make_shared<CRegExp>();
+  regexp->setPositionMoves(moves);
+  if (backRE) {
+    regexp->setBackRE(backRE);
+  }
+  regexp->setRE(&pattern);
+  regExpCacheStats.compiled++;
+  if (regexp->isOk()) {
+    regExpCache[regexp->hasBackTrace() ? back_key : key] = regexp;
+  }
+  return regexp;
+}
+
+std::shared_ptr<CRegExp> HrcLibrary::Impl::findRegExp(const UnicodeString& key) const
+{
+  const auto cached = regExpCache.find(key);
+  return cached != regExpCache.end() ? cached->second.lock() : nullptr;
+}
+
+/** Removes REs, which are not used by the loaded schemes, from the cache.
+*/
+void HrcLibrary::Impl::pruneRegExpCache()
+{
+  for (auto it = regExpCache.begin(); it != regExpCache.end();) {
+    if (it->second.expired()) {
+      it = regExpCache.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+RegExpCacheStats HrcLibrary::Impl::getRegExpCacheStats() const
+{
+  RegExpCacheStats stats = regExpCacheStats;
+  stats.cached = regExpCache.size();
+  return stats;
+}
+
 uUnicodeString HrcLibrary::Impl::useEntities(const UnicodeString* name)
 {
   int copypos = 0;
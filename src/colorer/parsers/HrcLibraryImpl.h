@@ -32,6 +32,7 @@ class HrcLibrary::Impl
   size_t getRegionCount() const;
   const Region* getRegion(unsigned int id) const;
   const Region* getRegion(const UnicodeString* name);
+  RegExpCacheStats getRegExpCacheStats() const;
 
  protected:
   enum class QualifyNameType { QNT_DEFINE, QNT_SCHEME, QNT_ENTITY };
@@ -47,6 +48,9 @@ class HrcLibrary::Impl
   std::vector<const Region*> regionNamesVector;
   std::unordered_map<UnicodeString, const Region*> regionNamesHash;
   std::unordered_map<UnicodeString, UnicodeString*> schemeEntitiesHash;
+  // compiled regular expressions by pattern and compile options, see compileRegExp()
+  std::unordered_map<UnicodeString, std::weak_ptr<CRegExp>> regExpCache;
+  RegExpCacheStats regExpCacheStats;
 
   FileType* current_parse_type = nullptr;
   XmlInputSource* current_input_source = nullptr;
@@ -89,6 +93,9 @@ class HrcLibrary::Impl
   void updateSchemeLink(uUnicodeString& scheme_name, SchemeImpl** scheme_impl, byte scheme_type,
                         const SchemeImpl* current_scheme);
   uUnicodeString useEntities(const UnicodeString* name);
+  std::shared_ptr<CRegExp> compileRegExp(const UnicodeString& pattern, bool moves, CRegExp* backRE = nullptr);
+  [[nodiscard]] std::shared_ptr<CRegExp> findRegExp(const UnicodeString& key) const;
+  void pruneRegExpCache();
   const Region* getNCRegion(const XMLNode* elem, const UnicodeString& tag);
   const Region* getNCRegion(const UnicodeString* name, bool logErrors);
   void loopSchemeKeywords(const XMLNode& elem, const SchemeImpl* scheme,
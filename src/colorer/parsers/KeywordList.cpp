@@ -34,8 +34,97 @@ void KeywordList::sortList()
   }
 }
 
-/* Searches previous elements num with same partial name
-   for example:
+UChar KeywordTrie::foldChar(UChar c) const
+{
+  if (!foldCase) {
+    return c;
+  }
+  if (c < 0x80) {
+    return c >= 'A' && c <= 'Z' ? static_cast<UChar>(c + ('a' - 'A')) : c;
+  }
+  return Character::foldCase(c);
+}
+
+int KeywordTrie::insert(const UnicodeString& key)
+{
+  int node = 0;
+  for (int pos = 0; pos < key.length(); pos++) {
+    const UChar c = foldChar(key[pos]);
+    auto it = buildNodes[node].children.find(c);
+    if (it == buildNodes[node].children.end()) {
+      it = buildNodes[node].children.emplace(c, static_cast<int>(buildNodes.size())).first;
+      buildNodes.emplace_back();
+    }
+    node = it->second;
+  }
+  if (buildNodes[node].key == -1) {
+    buildNodes[node].key = static_cast<int>(keyShorter.size());
+    keyShorter.push_back(-1);
+  }
+  return buildNodes[node].key;
+}
+
+void KeywordTrie::freeze()
+{
+  // breadth first order keeps the edges of each node together
+  trieNodes.assign(buildNodes.size(), TrieNode());
+  trieEdges.clear();
+  trieEdges.reserve(buildNodes.size() - 1);
+  std::vector<int> order(1, 0);
+  // the longest key on the path to the node
+  std::vector<int> shorter(buildNodes.size(), -1);
+  for (size_t n = 0; n < order.size(); n++) {
+    const BuildNode& node = buildNodes[order[n]];
+    TrieNode& trie_node = trieNodes[n];
+    trie_node.key = node.key;
+    if (node.key != -1) {
+      keyShorter[node.key] = shorter[order[n]];
+    }
+    trie_node.firstEdge = static_cast<int>(trieEdges.size());
+    trie_node.edgeCount = static_cast<int>(node.children.size());
+    for (const auto& child : node.children) {
+      shorter[child.second] = node.key != -1 ? node.key : shorter[order[n]];
+      trieEdges.push_back({child.first, static_cast<int>(order.size())});
+      order.push_back(child.second);
+    }
+  }
+  buildNodes.clear();
+}
+
+int KeywordTrie::findLongest(const UnicodeString& str, int pos, int end) const
+{
+  int found = -1;
+  if (trieNodes.empty()) {
+    return found;
+  }
+  int node = 0;
+  for (; pos < end; pos++) {
+    const TrieNode& trie_node = trieNodes[node];
+    const UChar c = foldChar(str[pos]);
+    int left = trie_node.firstEdge;
+    int right = left + trie_node.edgeCount;
+    while (left < right) {
+      const int mid = left + (right - left) / 2;
+      if (trieEdges[mid].c < c) {
+        left = mid + 1;
+      }
+      else {
+        right = mid;
+      }
+    }
+    if (left == trie_node.firstEdge + trie_node.edgeCount || trieEdges[left].c != c) {
+      break;
+    }
+    node = trieEdges[left].node;
+    if (trieNodes[node].key != -1) {
+      found = trieNodes[node].key;
+    }
+  }
+  return found;
+}
+
+/* Builds the trie of keywords and links the keyword with the longest keyword,
+   which is its prefix, for example:
    3: getParameterName  2
    2: getParameter      1
    1: getParam          0
@@ -43,18 +132,30 @@ void KeywordList::sortList()
 */
 void KeywordList::substrIndex()
 {
-  for (int i = count - 1; i > 0; i--) {
-    for (int ii = i - 1; ii != 0; ii--) {
-      if ((*kwList[ii].keyword)[0] != (*kwList[i].keyword)[0]) {
-        break;
-      }
-      if (kwList[ii].keyword->length() < kwList[i].keyword->length() &&
-          UnicodeString(*kwList[i].keyword, 0, kwList[ii].keyword->length())
-                  .compare(*kwList[ii].keyword) == 0)
-      {
-        kwList[i].indexOfShorter = ii;
-        break;
-      }
+  trie = std::make_unique<KeywordTrie>(!matchCase);
+  keyKeywords.clear();
+  for (int i = 0; i < count; i++) {
+    const int key = trie->insert(*kwList[i].keyword);
+    if (key == static_cast<int>(keyKeywords.size())) {
+      keyKeywords.push_back(i);
     }
+    else {
+      // the same keyword found later in the list replaces previous one
+      keyKeywords[key] = i;
+    }
+  }
+  trie->freeze();
+  for (size_t key = 0; key < keyKeywords.size(); key++) {
+    const int shorter = trie->getShorter(static_cast<int>(key));
+    kwList[keyKeywords[key]].indexOfShorter = shorter == -1 ? -1 : keyKeywords[shorter];
+  }
+}
+
+int KeywordList::findLongest(const UnicodeString& str, int pos, int end) const
+{
+  if (!trie) {
+    return -1;
   }
+  const int key = trie->findLongest(str, pos, end);
+  return key == -1 ? -1 : keyKeywords[key];
 }
@@ -2,6 +2,8 @@
 #define COLORER_KEYWORDLIST_H
 
 #include <climits>
+#include <map>
+#include <vector>
 #include "colorer/Common.h"
 #include "colorer/Region.h"
 
@@ -16,10 +18,84 @@ struct KeywordInfo
   std::unique_ptr<const UnicodeString> keyword;
   const Region* region = nullptr;
   bool isSymbol = false;
+  // index of the longest keyword, which is a prefix of this one
   int indexOfShorter = -1;
 };
 
+/** Trie over UTF-16 units of keys, which is searched over the line without copying it.
+    Keys are numbered in the order of insert, equal keys get the same number.
+    @ingroup colorer_parsers
+*/
+class KeywordTrie
+{
+ public:
+  /**
+    @param fold keys and lines are compared with folded case.
+  */
+  explicit KeywordTrie(bool fold) : foldCase(fold) {}
+
+  /**
+    Adds the key, until freeze() is called.
+    @return number of the key.
+  */
+  int insert(const UnicodeString& key);
+  /**
+    Builds the trie of inserted keys.
+  */
+  void freeze();
+
+  /**
+    Searches the longest key, which starts at @c pos of the line and ends before @c end.
+    @return number of the key, or -1.
+  */
+  [[nodiscard]] int findLongest(const UnicodeString& str, int pos, int end) const;
+  /**
+    Returns number of the longest key, which is a prefix of the key @c key, or -1.
+  */
+  [[nodiscard]] int getShorter(int key) const
+  {
+    return keyShorter[key];
+  }
+  [[nodiscard]] int getKeyCount() const
+  {
+    return static_cast<int>(keyShorter.size());
+  }
+
+ private:
+  /** Node of the trie. Edges of the node are sorted by the character. */
+  struct TrieNode
+  {
+    int firstEdge = 0;
+    int edgeCount = 0;
+    // key, which ends at this node
+    int key = -1;
+  };
+
+  struct TrieEdge
+  {
+    UChar c;
+    int node;
+  };
+
+  /** Node of the trie, which is not frozen. */
+  struct BuildNode
+  {
+    std::map<UChar, int> children;
+    int key = -1;
+  };
+
+  bool foldCase;
+  std::vector<TrieNode> trieNodes;
+  std::vector<TrieEdge> trieEdges;
+  std::vector<int> keyShorter;
+  std::vector<BuildNode> buildNodes = std::vector<BuildNode>(1);
+
+  [[nodiscard]] UChar foldChar(UChar c) const;
+};
+
 /** List of keywords.
+    Keywords are indexed with the trie over their characters, folded for the list,
+    which ignores case.
     @ingroup colorer_parsers
 */
 class KeywordList
@@ -33,7 +109,23 @@ class KeywordList
   explicit KeywordList(size_t list_size);
   ~KeywordList();
   void sortList();
+  /**
+    Builds the trie of keywords and links keywords to their prefixes.
+    Should be called after sortList().
+  */
   void substrIndex();
+
+  /**
+    Searches the longest keyword, which starts at @c pos of the line and ends before @c end.
+    Shorter keywords at the same position are reached through KeywordInfo::indexOfShorter.
+    @return index of the keyword in kwList, or -1.
+  */
+  [[nodiscard]] int findLongest(const UnicodeString& str, int pos, int end) const;
+
+ private:
+  std::unique_ptr<KeywordTrie> trie;
+  // keyword for each key of the trie
+  std::vector<int> keyKeywords;
 };
 
 #endif  //COLORER_KEYWORDLIST_H
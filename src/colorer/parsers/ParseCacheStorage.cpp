@@ -0,0 +1,389 @@
+#include "colorer/parsers/ParseCacheStorage.h"
+#include <algorithm>
+#include <memory>
+
+// is changed with the format of the stream
+static const uint32_t STORAGE_MAGIC = 0x31435043;
+
+static const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+static const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+static uint64_t hashValue(uint64_t hash, uint64_t value)
+{
+  for (int i = 0; i < 8; i++) {
+    hash = (hash ^ (value & 0xFF)) * FNV_PRIME;
+    value >>= 8;
+  }
+  return hash;
+}
+
+static uint64_t hashString(uint64_t hash, const UnicodeString* str)
+{
+  if (!str) {
+    return hashValue(hash, UINT64_MAX);
+  }
+  const int32_t len = str->length();
+  hash = hashValue(hash, len);
+  for (int32_t i = 0; i < len; i++) {
+    const UChar c = (*str)[i];
+    hash = (hash ^ (c & 0xFF)) * FNV_PRIME;
+    hash = (hash ^ (c >> 8)) * FNV_PRIME;
+  }
+  return hash;
+}
+
+static uint64_t hashRegExp(uint64_t hash, const CRegExp* re)
+{
+  return hashString(hash, re ? &re->getSource() : nullptr);
+}
+
+template <typename T>
+static void writeValue(std::ostream& out, T value)
+{
+  out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static bool readValue(std::istream& in, T* value)
+{
+  in.read(reinterpret_cast<char*>(value), sizeof(T));
+  return static_cast<bool>(in);
+}
+
+ParseCacheStorage::ParseCacheStorage(SchemeImpl* base_scheme) : fingerprint(FNV_OFFSET)
+{
+  if (base_scheme) {
+    addScheme(base_scheme);
+  }
+  // list of schemes grows, while their nodes are added
+  for (size_t i = 0; i < schemes.size(); i++) {
+    const SchemeImpl* scheme = schemes[i];
+    fingerprint = hashString(fingerprint, scheme->getName());
+    fingerprint = hashValue(fingerprint, scheme->nodes.size());
+    for (size_t n = 0; n < scheme->nodes.size(); n++) {
+      const SchemeNode* node = scheme->nodes[n].get();
+      const NodeRef ref {static_cast<int32_t>(i), static_cast<int32_t>(n)};
+      if (node->type == SchemeNode::SchemeNodeType::SNT_BLOCK) {
+        blockRefs.emplace(static_cast<const SchemeNodeBlock*>(node), ref);
+      }
+      else if (node->type == SchemeNode::SchemeNodeType::SNT_INHERIT) {
+        virtualRefs.emplace(&static_cast<const SchemeNodeInherit*>(node)->virtualEntryVector, ref);
+      }
+      addFingerprint(node);
+    }
+  }
+}
+
+int32_t ParseCacheStorage::addScheme(SchemeImpl* scheme)
+{
+  auto it = schemeIds.find(scheme);
+  if (it != schemeIds.end()) {
+    return it->second;
+  }
+  const auto id = static_cast<int32_t>(schemes.size());
+  schemes.push_back(scheme);
+  schemeIds.emplace(scheme, id);
+  return id;
+}
+
+/** Adds to the fingerprint the properties of the node, which change the parse cache.
+    Regions are not added, they are not kept in the cache.
+*/
+void ParseCacheStorage::addFingerprint(const SchemeNode* node)
+{
+  auto add_scheme = [this](SchemeImpl* ref, const UnicodeString* name) {
+    fingerprint = hashValue(fingerprint, ref ? addScheme(ref) : -1);
+    if (!ref) {
+      fingerprint = hashString(fingerprint, name);
+    }
+  };
+
+  fingerprint = hashValue(fingerprint, static_cast<uint64_t>(node->type));
+  switch (node->type) {
+    case SchemeNode::SchemeNodeType::SNT_RE: {
+      const auto* re = static_cast<const SchemeNodeRegexp*>(node);
+      fingerprint = hashRegExp(fingerprint, re->start.get());
+      fingerprint = hashValue(fingerprint, re->lowPriority);
+      break;
+    }
+    case SchemeNode::SchemeNodeType::SNT_BLOCK: {
+      const auto* block = static_cast<const SchemeNodeBlock*>(node);
+      fingerprint = hashRegExp(fingerprint, block->start.get());
+      fingerprint = hashRegExp(fingerprint, block->end.get());
+      fingerprint = hashValue(fingerprint, block->lowPriority);
+      fingerprint = hashValue(fingerprint, block->lowContentPriority);
+      add_scheme(block->scheme, block->schemeName.get());
+      break;
+    }
+    case SchemeNode::SchemeNodeType::SNT_KEYWORDS: {
+      const auto* kw_list = static_cast<const SchemeNodeKeywords*>(node)->kwList.get();
+      fingerprint = hashValue(fingerprint, kw_list->matchCase);
+      fingerprint = hashValue(fingerprint, kw_list->count);
+      for (int i = 0; i < kw_list->count; i++) {
+        fingerprint = hashString(fingerprint, kw_list->kwList[i].keyword.get());
+        fingerprint = hashValue(fingerprint, kw_list->kwList[i].isSymbol);
+      }
+      fingerprint = hashValue(fingerprint, static_cast<const SchemeNodeKeywords*>(node)->worddiv != nullptr);
+      break;
+    }
+    case SchemeNode::SchemeNodeType::SNT_INHERIT: {
+      const auto* inherit = static_cast<const SchemeNodeInherit*>(node);
+      add_scheme(inherit->scheme, inherit->schemeName.get());
+      fingerprint = hashValue(fingerprint, inherit->virtualEntryVector.size());
+      for (const VirtualEntry* entry : inherit->virtualEntryVector) {
+        add_scheme(entry->virtScheme, entry->virtSchemeName.get());
+        add_scheme(entry->substScheme, entry->substSchemeName.get());
+      }
+      break;
+    }
+  }
+}
+
+SchemeNode* ParseCacheStorage::getNode(const NodeRef& ref, SchemeNode::SchemeNodeType type) const
+{
+  if (ref.scheme < 0 || ref.scheme >= static_cast<int32_t>(schemes.size())) {
+    return nullptr;
+  }
+  const auto& nodes = schemes[ref.scheme]->nodes;
+  if (ref.node < 0 || ref.node >= static_cast<int32_t>(nodes.size()) || nodes[ref.node]->type != type) {
+    return nullptr;
+  }
+  return nodes[ref.node].get();
+}
+
+void ParseCacheStorage::write(std::ostream& out, const ParseCache* root, int lines, uint64_t text_hash) const
+{
+  // entries are listed before their children and next entries, without recursion
+  std::vector<const ParseCache*> entries;
+  std::unordered_map<const ParseCache*, int32_t> indexes;
+  indexes.emplace(root, -1);
+  std::vector<const ParseCache*> stack;
+  if (root->children) {
+    stack.push_back(root->children);
+  }
+  while (!stack.empty()) {
+    const ParseCache* entry = stack.back();
+    stack.pop_back();
+    indexes.emplace(entry, static_cast<int32_t>(entries.size()));
+    entries.push_back(entry);
+    if (entry->next) {
+      stack.push_back(entry->next);
+    }
+    if (entry->children) {
+      stack.push_back(entry->children);
+    }
+  }
+
+  writeValue(out, STORAGE_MAGIC);
+  writeValue(out, fingerprint);
+  writeValue<int32_t>(out, lines);
+  writeValue(out, text_hash);
+  writeValue<int32_t>(out, static_cast<int32_t>(entries.size()));
+  const NodeRef no_ref {-1, -1};
+  for (const ParseCache* entry : entries) {
+    writeValue(out, indexes.at(entry->parent));
+    writeValue<int32_t>(out, entry->sline);
+    writeValue<int32_t>(out, entry->eline);
+    auto scheme_id = schemeIds.find(entry->scheme);
+    writeValue<int32_t>(out, scheme_id != schemeIds.end() ? scheme_id->second : -1);
+    auto block_ref = blockRefs.find(entry->clender);
+    writeValue(out, block_ref != blockRefs.end() ? block_ref->second : no_ref);
+
+    int32_t vcount = 0;
+    while (entry->vcache && entry->vcache[vcount]) {
+      vcount++;
+    }
+    writeValue(out, vcount);
+    for (int32_t i = 0; i < vcount; i++) {
+      auto virtual_ref = virtualRefs.find(entry->vcache[i]);
+      writeValue(out, virtual_ref != virtualRefs.end() ? virtual_ref->second : no_ref);
+    }
+
+    SMatches match {};
+    entry->matchstart.restore(match);
+    writeValue<int32_t>(out, match.cMatch);
+    for (int i = 0; i < match.cMatch; i++) {
+      writeValue<int32_t>(out, match.s[i]);
+      writeValue<int32_t>(out, match.e[i]);
+    }
+    writeValue<int32_t>(out, match.cnMatch);
+    for (int i = 0; i < match.cnMatch; i++) {
+      writeValue<int32_t>(out, match.ns[i]);
+      writeValue<int32_t>(out, match.ne[i]);
+    }
+
+    if (!entry->backLine) {
+      writeValue<int32_t>(out, -1);
+      continue;
+    }
+    const int32_t len = entry->backLine->length();
+    writeValue(out, len);
+    for (int32_t i = 0; i < len; i++) {
+      writeValue<uint16_t>(out, (*entry->backLine)[i]);
+    }
+  }
+}
+
+bool ParseCacheStorage::readHeader(std::istream& in, int* lines, uint64_t* text_hash) const
+{
+  uint32_t magic;
+  uint64_t stored_fingerprint;
+  int32_t stored_lines;
+  if (!readValue(in, &magic) || magic != STORAGE_MAGIC || !readValue(in, &stored_fingerprint) ||
+      stored_fingerprint != fingerprint || !readValue(in, &stored_lines) || stored_lines < 0 ||
+      !readValue(in, text_hash))
+  {
+    return false;
+  }
+  *lines = stored_lines;
+  return true;
+}
+
+/** Checks, that the matched brackets are inside of the line with @c len characters.
+    Brackets, which are not matched, have -1 positions.
+*/
+static bool isMatchInLine(const SMatches& match, int32_t len)
+{
+  auto in_line = [len](int s, int e) { return (s == -1 && e == -1) || (0 <= s && s <= e && e <= len); };
+  for (int m = 0; m < match.cMatch; m++) {
+    if (!in_line(match.s[m], match.e[m])) {
+      return false;
+    }
+  }
+  for (int m = 0; m < match.cnMatch; m++) {
+    if (!in_line(match.ns[m], match.ne[m])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ParseCacheStorage::readEntries(std::istream& in, ParseCache* root) const
+{
+  int32_t count;
+  if (!readValue(in, &count) || count < 0) {
+    return false;
+  }
+  std::vector<ParseCache*> entries;
+  // last children of the read entries, and of the root
+  std::vector<ParseCache*> last_children;
+  ParseCache* root_last = nullptr;
+  for (int32_t i = 0; i < count; i++) {
+    int32_t parent_index;
+    int32_t sline;
+    int32_t eline;
+    int32_t scheme_id;
+    NodeRef block_ref {};
+    int32_t vcount;
+    if (!readValue(in, &parent_index) || parent_index < -1 || parent_index >= i || !readValue(in, &sline) ||
+        !readValue(in, &eline) || !readValue(in, &scheme_id) || scheme_id < 0 ||
+        scheme_id >= static_cast<int32_t>(schemes.size()) || !readValue(in, &block_ref) ||
+        !readValue(in, &vcount) || vcount < 0)
+    {
+      return false;
+    }
+    const auto* clender = static_cast<SchemeNodeBlock*>(getNode(block_ref, SchemeNode::SchemeNodeType::SNT_BLOCK));
+    if (!clender) {
+      return false;
+    }
+    std::vector<VirtualEntryVector*> vlists;
+    for (int32_t v = 0; v < vcount; v++) {
+      NodeRef ref {};
+      if (!readValue(in, &ref)) {
+        return false;
+      }
+      auto* inherit = static_cast<SchemeNodeInherit*>(getNode(ref, SchemeNode::SchemeNodeType::SNT_INHERIT));
+      if (!inherit) {
+        return false;
+      }
+      vlists.push_back(&inherit->virtualEntryVector);
+    }
+
+    SMatches match {};
+    if (!readValue(in, &match.cMatch) || match.cMatch < 0 || match.cMatch > MATCHES_NUM) {
+      return false;
+    }
+    for (int m = 0; m < match.cMatch; m++) {
+      if (!readValue(in, &match.s[m]) || !readValue(in, &match.e[m])) {
+        return false;
+      }
+    }
+    if (!readValue(in, &match.cnMatch) || match.cnMatch < 0 || match.cnMatch > NAMED_MATCHES_NUM) {
+      return false;
+    }
+    for (int m = 0; m < match.cnMatch; m++) {
+      if (!readValue(in, &match.ns[m]) || !readValue(in, &match.ne[m])) {
+        return false;
+      }
+    }
+
+    int32_t len;
+    if (!readValue(in, &len) || len < -1) {
+      return false;
+    }
+    std::unique_ptr<UnicodeString> back_line;
+    if (len >= 0) {
+      back_line = std::make_unique<UnicodeString>();
+      for (int32_t c = 0; c < len; c++) {
+        uint16_t unit;
+        if (!readValue(in, &unit)) {
+          return false;
+        }
+        back_line->append(static_cast<UChar>(unit));
+      }
+      // back references of the block end are read from the line by the match positions
+      if (!isMatchInLine(match, len)) {
+        return false;
+      }
+    }
+
+    // entries are inside of their parent, after the previous entry of the level
+    ParseCache* parent = parent_index < 0 ? root : entries[parent_index];
+    ParseCache*& last = parent_index < 0 ? root_last : last_children[parent_index];
+    if (sline < 0 || sline > eline || sline < parent->sline || (parent != root && eline > parent->eline) ||
+        (last && sline < last->eline))
+    {
+      return false;
+    }
+
+    auto* entry = new ParseCache();
+    entry->sline = sline;
+    entry->eline = eline;
+    entry->scheme = schemes[scheme_id];
+    entry->clender = clender;
+    if (vcount > 0) {
+      entry->vcache = new VirtualEntryVector*[vcount + 1];
+      std::copy(vlists.begin(), vlists.end(), entry->vcache);
+      entry->vcache[vcount] = nullptr;
+    }
+    entry->matchstart.store(match);
+    entry->backLine = back_line.release();
+
+    entry->parent = parent;
+    entry->prev = last;
+    if (last) {
+      last->next = entry;
+    }
+    else {
+      parent->children = entry;
+    }
+    last = entry;
+    entries.push_back(entry);
+    last_children.push_back(nullptr);
+  }
+  return true;
+}
+
+bool ParseCacheStorage::hashLines(LineSource* source, int lines, uint64_t* hash)
+{
+  uint64_t result = FNV_OFFSET;
+  for (int i = 0; i < lines; i++) {
+    const UnicodeString* line = source->getLine(i);
+    if (!line) {
+      return false;
+    }
+    result = hashString(result, line);
+  }
+  *hash = result;
+  return true;
+}
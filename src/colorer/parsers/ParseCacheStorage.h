@@ -0,0 +1,63 @@
+#ifndef COLORER_PARSECACHESTORAGE_H
+#define COLORER_PARSECACHESTORAGE_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+#include "colorer/LineSource.h"
+#include "colorer/parsers/TextParserHelpers.h"
+
+/** Writes the parse cache tree into the binary stream and reads it back.
+    Schemes and their nodes are written as indexes in the list of schemes,
+    reachable from the base scheme. The fingerprint of these schemes is kept
+    in the stream, so the cache is read only with the same HRC schemes.
+    @ingroup colorer_parsers
+*/
+class ParseCacheStorage
+{
+ public:
+  explicit ParseCacheStorage(SchemeImpl* base_scheme);
+
+  /**
+    Writes the cache, which covers @c lines first lines of the text with @c text_hash.
+  */
+  void write(std::ostream& out, const ParseCache* root, int lines, uint64_t text_hash) const;
+  /**
+    Reads the header of the stream.
+    @return false, if the stream is not written for the same schemes.
+  */
+  bool readHeader(std::istream& in, int* lines, uint64_t* text_hash) const;
+  /**
+    Reads the cache entries into the children of @c root.
+    @return false, if the stream is broken. Entries, which are read, are kept in the root.
+  */
+  bool readEntries(std::istream& in, ParseCache* root) const;
+
+  /**
+    Computes the hash of @c lines first lines of the text.
+    @return false, if the source has less lines.
+  */
+  static bool hashLines(LineSource* source, int lines, uint64_t* hash);
+
+ private:
+  /** Position of the node in the list of schemes. */
+  struct NodeRef
+  {
+    int32_t scheme;
+    int32_t node;
+  };
+
+  std::vector<SchemeImpl*> schemes;
+  std::unordered_map<const SchemeImpl*, int32_t> schemeIds;
+  std::unordered_map<const SchemeNodeBlock*, NodeRef> blockRefs;
+  std::unordered_map<const VirtualEntryVector*, NodeRef> virtualRefs;
+  uint64_t fingerprint;
+
+  int32_t addScheme(SchemeImpl* scheme);
+  void addFingerprint(const SchemeNode* node);
+  [[nodiscard]] SchemeNode* getNode(const NodeRef& ref, SchemeNode::SchemeNodeType type) const;
+};
+
+#endif  // COLORER_PARSECACHESTORAGE_H
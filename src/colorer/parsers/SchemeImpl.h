@@ -6,7 +6,9 @@
 #include "colorer/Scheme.h"
 #include "colorer/TextParser.h"
 #include "colorer/cregexp/cregexp.h"
+#include "colorer/parsers/SchemeKeywords.h"
 #include "colorer/parsers/SchemeNode.h"
+#include "colorer/parsers/SchemePrefilter.h"
 
 class FileType;
 
@@ -18,6 +20,8 @@ class SchemeImpl : public Scheme
 {
   friend class HrcLibrary;
   friend class TextParser;
+  friend class SchemePrefilter;
+  friend class ParseCacheStorage;
 
  public:
   [[nodiscard]] const UnicodeString* getName() const override
@@ -33,6 +37,10 @@ class SchemeImpl : public Scheme
  protected:
   uUnicodeString schemeName;
   std::vector<std::unique_ptr<SchemeNode>> nodes;
+  // nodes, which could match at the position
+  SchemePrefilter prefilter;
+  // keywords of all keyword nodes
+  SchemeKeywords keywords;
   FileType* fileType = nullptr;
 
   explicit SchemeImpl(const UnicodeString* sn)
@@ -0,0 +1,112 @@
+#include "colorer/parsers/SchemeKeywords.h"
+
+void SchemeKeywords::build(const std::vector<std::unique_ptr<SchemeNode>>& nodes)
+{
+  trie.reset();
+  keyEntries.clear();
+  entries.clear();
+  std::vector<const SchemeNodeKeywords*> keyword_nodes(nodes.size(), nullptr);
+  int keyword_count = 0;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i]->type == SchemeNode::SchemeNodeType::SNT_KEYWORDS) {
+      const auto* node = static_cast<const SchemeNodeKeywords*>(nodes[i].get());
+      if (node->kwList->count > 0) {
+        keyword_nodes[i] = node;
+        keyword_count++;
+      }
+    }
+  }
+  // single list is searched by its own trie
+  if (keyword_count < 2) {
+    return;
+  }
+
+  // keys are folded, keywords of lists with case are compared at the match
+  auto new_trie = std::make_unique<KeywordTrie>(true);
+  std::vector<std::vector<Entry>> key_entries;
+  for (size_t i = 0; i < keyword_nodes.size(); i++) {
+    if (!keyword_nodes[i]) {
+      continue;
+    }
+    const KeywordList* list = keyword_nodes[i]->kwList.get();
+    for (int k = 0; k < list->count; k++) {
+      const int key = new_trie->insert(*list->kwList[k].keyword);
+      if (key == static_cast<int>(key_entries.size())) {
+        key_entries.emplace_back();
+      }
+      auto& key_list = key_entries[key];
+      // the same keyword found later in the list replaces previous one,
+      // keywords of the list with case could differ in case for the same key
+      auto same = key_list.rbegin();
+      for (; same != key_list.rend() && same->node == static_cast<int>(i); ++same) {
+        if (!list->matchCase || list->kwList[same->keyword].keyword->compare(*list->kwList[k].keyword) == 0) {
+          break;
+        }
+      }
+      if (same != key_list.rend() && same->node == static_cast<int>(i)) {
+        same->keyword = k;
+        continue;
+      }
+      key_list.push_back({static_cast<int>(i), k});
+    }
+  }
+  new_trie->freeze();
+
+  keyEntries.reserve(key_entries.size() + 1);
+  for (const auto& key_list : key_entries) {
+    keyEntries.push_back(static_cast<int>(entries.size()));
+    entries.insert(entries.end(), key_list.begin(), key_list.end());
+  }
+  keyEntries.push_back(static_cast<int>(entries.size()));
+  trie = std::move(new_trie);
+}
+
+SchemeKeywords::Match SchemeKeywords::find(const std::vector<std::unique_ptr<SchemeNode>>& nodes,
+                                           const UnicodeString& str, int pos, int end) const
+{
+  Match match;
+  for (int key = trie->findLongest(str, pos, end); key != -1; key = trie->getShorter(key)) {
+    for (int e = keyEntries[key]; e < keyEntries[key + 1]; e++) {
+      const Entry& entry = entries[e];
+      // the node is found with the longer keyword
+      if (match.node != -1 && entry.node >= match.node) {
+        break;
+      }
+      const auto* node = static_cast<const SchemeNodeKeywords*>(nodes[entry.node].get());
+      const KeywordInfo& keyword = node->kwList->kwList[entry.keyword];
+      if (node->kwList->matchCase) {
+        const UnicodeString& word = *keyword.keyword;
+        int i = 0;
+        while (i < word.length() && word[i] == str[pos + i]) {
+          i++;
+        }
+        if (i < word.length()) {
+          continue;
+        }
+      }
+      if (isBound(node, keyword, str, pos, end)) {
+        match.node = entry.node;
+        match.keyword = entry.keyword;
+        break;
+      }
+    }
+  }
+  return match;
+}
+
+bool SchemeKeywords::isBound(const SchemeNodeKeywords* node, const KeywordInfo& keyword, const UnicodeString& str,
+                             int pos, int end)
+{
+  if (keyword.isSymbol) {
+    return true;
+  }
+  const int kw_end = pos + keyword.keyword->length();
+  if (!node->worddiv) {
+    // default word bound
+    return !((pos > 0 && (Character::isLetterOrDigit(str[pos - 1]) || str[pos - 1] == L'_')) ||
+             (kw_end < end && (Character::isLetterOrDigit(str[kw_end]) || str[kw_end] == L'_')));
+  }
+  // custom check for word bound
+  return !((pos > 0 && !node->worddiv->contains(str[pos - 1])) ||
+           (kw_end < end && !node->worddiv->contains(str[kw_end])));
+}
@@ -0,0 +1,63 @@
+#ifndef COLORER_SCHEMEKEYWORDS_H
+#define COLORER_SCHEMEKEYWORDS_H
+
+#include <memory>
+#include <vector>
+#include "colorer/parsers/KeywordList.h"
+#include "colorer/parsers/SchemeNode.h"
+
+/** Keywords of all keyword nodes of the scheme in one trie.
+    The trie is searched once at the position for all keyword nodes. The match is
+    the first keyword node of the scheme, which has a keyword at the position,
+    with its longest keyword, as searches of the nodes one after another would find.
+    Built only for schemes with several keyword nodes, it is not changed by parsers.
+    @ingroup colorer_parsers
+*/
+class SchemeKeywords
+{
+ public:
+  /** Keyword found in the scheme. */
+  struct Match
+  {
+    // index of the keyword node in the scheme, or -1
+    int node = -1;
+    // index of the keyword in the list of the node
+    int keyword = -1;
+  };
+
+  /**
+    Builds the trie for the complete list of scheme nodes.
+  */
+  void build(const std::vector<std::unique_ptr<SchemeNode>>& nodes);
+  [[nodiscard]] bool isBuilt() const
+  {
+    return trie != nullptr;
+  }
+
+  /**
+    Searches keywords, which start at @c pos of the line and end before @c end.
+  */
+  [[nodiscard]] Match find(const std::vector<std::unique_ptr<SchemeNode>>& nodes, const UnicodeString& str, int pos,
+                           int end) const;
+
+  /**
+    Checks, that the keyword of the node at @c pos is bounded by word dividers of the node.
+  */
+  static bool isBound(const SchemeNodeKeywords* node, const KeywordInfo& keyword, const UnicodeString& str, int pos,
+                      int end);
+
+ private:
+  /** Keyword of the node for the key of the trie. */
+  struct Entry
+  {
+    int node;
+    int keyword;
+  };
+
+  std::unique_ptr<KeywordTrie> trie;
+  // entries of the key start at keyEntries[key] and are ordered by the node
+  std::vector<int> keyEntries;
+  std::vector<Entry> entries;
+};
+
+#endif  // COLORER_SCHEMEKEYWORDS_H
@@ -44,7 +44,8 @@ class SchemeNodeRegexp final : public SchemeNode
 {
  public:
   bool lowPriority = false;
-  std::unique_ptr<CRegExp> start;
+  // shared by all nodes with the same pattern
+  std::shared_ptr<CRegExp> start;
   const Region* region = nullptr;
   const Region* regions[REGIONS_NUM] = {};
   const Region* regionsn[NAMED_REGIONS_NUM] = {};
@@ -61,8 +62,9 @@ class SchemeNodeBlock final : public SchemeNode
   bool lowContentPriority = false;
   uUnicodeString schemeName = nullptr;
   SchemeImpl* scheme = nullptr;
-  std::unique_ptr<CRegExp> start;
-  std::unique_ptr<CRegExp> end;
+  // shared by all nodes with the same patterns
+  std::shared_ptr<CRegExp> start;
+  std::shared_ptr<CRegExp> end;
   const Region* region = nullptr;
   const Region* regions[REGIONS_NUM] = {};
   const Region* regionsn[NAMED_REGIONS_NUM] = {};
@@ -0,0 +1,143 @@
+#include "colorer/parsers/SchemePrefilter.h"
+#include <map>
+#include "colorer/parsers/SchemeImpl.h"
+
+void SchemePrefilter::StartChars::add(const StartChars& chars)
+{
+  latin |= chars.latin;
+  wide = wide || chars.wide;
+  end = end || chars.end;
+}
+
+/** Start positions of the node, which is tried at any position.
+*/
+static void setAny(std::bitset<0x100>& latin, bool& wide, bool& end)
+{
+  latin.set();
+  wide = true;
+  end = true;
+}
+
+void SchemePrefilter::build(const std::vector<std::unique_ptr<SchemeNode>>& nodes)
+{
+  const size_t count = nodes.size();
+  nodeChars.assign(count, StartChars());
+  for (size_t i = 0; i < count; i++) {
+    const SchemeNode* node = nodes[i].get();
+    std::unique_ptr<CharacterClass> own;
+    const CharacterClass* first = nullptr;
+    switch (node->type) {
+      case SchemeNode::SchemeNodeType::SNT_RE:
+        own = static_cast<const SchemeNodeRegexp*>(node)->start->getFirstChars();
+        first = own.get();
+        break;
+      case SchemeNode::SchemeNodeType::SNT_BLOCK:
+        own = static_cast<const SchemeNodeBlock*>(node)->start->getFirstChars();
+        first = own.get();
+        break;
+      case SchemeNode::SchemeNodeType::SNT_KEYWORDS: {
+        const auto* kw_list = static_cast<const SchemeNodeKeywords*>(node)->kwList.get();
+        if (kw_list->count == 0)
+          continue;
+        first = kw_list->firstChar.get();
+        break;
+      }
+      case SchemeNode::SchemeNodeType::SNT_INHERIT:
+        // inherited scheme is filtered by its own prefilter
+        break;
+    }
+    StartChars& chars = nodeChars[i];
+    if (!first) {
+      setAny(chars.latin, chars.wide, chars.end);
+      continue;
+    }
+    for (int c = 0; c < LATIN_UNITS; c++) {
+      if (first->contains(static_cast<UChar>(c)))
+        chars.latin.set(c);
+    }
+#ifdef COLORER_FEATURE_ICU
+    chars.wide = !first->containsNone(LATIN_UNITS, 0xFFFF);
+#else
+    chars.wide = true;
+#endif
+  }
+  rows.clear();
+  addRows(nodeChars, plainRows);
+  plainRowsCount = rows.size();
+  state = LinkState::NONE;
+}
+
+void SchemePrefilter::link(const std::vector<std::unique_ptr<SchemeNode>>& nodes)
+{
+  // filter is not built for the scheme, which is not loaded
+  if (state == LinkState::LINKING || (state == LinkState::LINKED && linkComplete) ||
+      nodeChars.size() != nodes.size())
+    return;
+  state = LinkState::LINKING;
+  linkComplete = true;
+  std::vector<StartChars> chars = nodeChars;
+  schemeChars = StartChars();
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i]->type == SchemeNode::SchemeNodeType::SNT_INHERIT) {
+      const auto* inherit = static_cast<const SchemeNodeInherit*>(nodes[i].get());
+      SchemeImpl* scheme = inherit->scheme;
+      // virtual entries of the node change the schemes inherited by the scheme
+      if (scheme && inherit->virtualEntryVector.empty()) {
+        SchemePrefilter& inherited = scheme->prefilter;
+        inherited.link(scheme->nodes);
+        // recursive inherit is tried at any position
+        if (inherited.state == LinkState::LINKED) {
+          chars[i] = inherited.schemeChars;
+          linkComplete = linkComplete && inherited.linkComplete;
+        }
+        else if (inherited.state == LinkState::NONE) {
+          linkComplete = false;
+        }
+      }
+      else if (!scheme && !inherit->schemeName) {
+        chars[i] = StartChars();
+      }
+      else if (!scheme) {
+        linkComplete = false;
+      }
+    }
+    schemeChars.add(chars[i]);
+  }
+  // lists of the previous link are replaced
+  rows.resize(plainRowsCount);
+  addRows(chars, linkedRows);
+  state = LinkState::LINKED;
+}
+
+void SchemePrefilter::addRows(const std::vector<StartChars>& chars, Rows& result)
+{
+  std::map<std::vector<int>, int> row_ids;
+  auto add_row = [&](std::vector<int>&& row) {
+    auto it = row_ids.find(row);
+    if (it == row_ids.end()) {
+      it = row_ids.emplace(row, static_cast<int>(rows.size())).first;
+      rows.push_back(std::move(row));
+    }
+    return it->second;
+  };
+
+  const int count = static_cast<int>(chars.size());
+  std::vector<int> wide_row;
+  std::vector<int> end_row;
+  for (int i = 0; i < count; i++) {
+    if (chars[i].wide)
+      wide_row.push_back(i);
+    if (chars[i].end)
+      end_row.push_back(i);
+  }
+  result.wide = add_row(std::move(wide_row));
+  result.end = add_row(std::move(end_row));
+  for (int c = 0; c < LATIN_UNITS; c++) {
+    std::vector<int> row;
+    for (int i = 0; i < count; i++) {
+      if (chars[i].latin.test(c))
+        row.push_back(i);
+    }
+    result.latin[c] = static_cast<uint16_t>(add_row(std::move(row)));
+  }
+}
@@ -0,0 +1,96 @@
+#ifndef COLORER_SCHEMEPREFILTER_H
+#define COLORER_SCHEMEPREFILTER_H
+
+#include <bitset>
+#include <memory>
+#include <vector>
+#include "colorer/parsers/SchemeNode.h"
+
+/** Selects nodes of the scheme, which could match at the position of the line.
+    Built from the first characters of regexp and block start REs and of keywords.
+    Candidates keep the order of nodes in the scheme, so the node priority is not changed.
+
+    Inherit nodes are candidates at any position, until the filter is linked.
+    Linked filter also has the lists, where inherit nodes are selected by the first
+    characters of the inherited schemes. These lists are valid only while there are
+    no virtual substitutions, which could change the inherited scheme.
+    Lists, which were linked before the inherited schemes were loaded, are linked again
+    by the next link() call.
+    @ingroup colorer_parsers
+*/
+class SchemePrefilter
+{
+ public:
+  /**
+    Builds the filter for the complete list of scheme nodes.
+  */
+  void build(const std::vector<std::unique_ptr<SchemeNode>>& nodes);
+  /**
+    Builds lists for inherit nodes, when links of the scheme nodes are resolved.
+    Linked filter is built again, while it depends on the inherit links, which are not resolved yet.
+  */
+  void link(const std::vector<std::unique_ptr<SchemeNode>>& nodes);
+  [[nodiscard]] bool isLinked() const
+  {
+    return state == LinkState::LINKED;
+  }
+
+  /**
+    Returns indexes of nodes, which could match at the position @c pos of the line @c str.
+    @param noVirtual there are no virtual substitutions for the inherited schemes.
+  */
+  const std::vector<int>& getCandidates(const UnicodeString& str, int pos, bool noVirtual = false) const
+  {
+    const Rows& r = noVirtual && state == LinkState::LINKED ? linkedRows : plainRows;
+    if (pos >= str.length())
+      return rows[r.end];
+    const UChar c = str[pos];
+    return rows[c < LATIN_UNITS ? r.latin[c] : r.wide];
+  }
+
+ private:
+  // units with own lists of candidates, others use the wide row
+  static const int LATIN_UNITS = 0x100;
+
+  /** Positions, where the node or the scheme could start. */
+  struct StartChars
+  {
+    std::bitset<LATIN_UNITS> latin;
+    bool wide = false;
+    bool end = false;
+
+    void add(const StartChars& chars);
+  };
+
+  /** Indexes of candidate lists for all positions. */
+  struct Rows
+  {
+    // lists for the latin units
+    uint16_t latin[LATIN_UNITS] = {};
+    // list for other units
+    int wide = 0;
+    // list for the end of line, where only zero length matches are possible
+    int end = 0;
+  };
+
+  enum class LinkState { NONE, LINKING, LINKED };
+
+  // lists of candidates, empty filter has no candidates
+  std::vector<std::vector<int>> rows = std::vector<std::vector<int>>(1);
+  Rows plainRows;
+  Rows linkedRows;
+
+  // start positions of nodes, inherit nodes could start anywhere
+  std::vector<StartChars> nodeChars;
+  // start positions of the whole scheme, including inherited schemes
+  StartChars schemeChars;
+  LinkState state = LinkState::NONE;
+  // linked lists do not depend on unresolved links or not loaded schemes
+  bool linkComplete = false;
+  // count of rows, which are used by the plain lists
+  size_t plainRowsCount = 1;
+
+  void addRows(const std::vector<StartChars>& chars, Rows& result);
+};
+
+#endif  // COLORER_SCHEMEPREFILTER_H
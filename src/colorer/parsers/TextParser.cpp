@@ -18,6 +18,21 @@ int TextParser::parse(int from, int num, TextParseMode mode)
   return pimpl->parse(from, num, mode);
 }
 
+int TextParser::parse(int from, int num, TextParseMode mode, const ParseBudget& budget)
+{
+  return pimpl->parse(from, num, mode, budget);
+}
+
+int TextParser::reparseLines(int from, int to, int num, int* damagedEnd)
+{
+  return pimpl->reparseLines(from, to, num, damagedEnd);
+}
+
+int TextParser::parseParallel(int from, int num, int threads)
+{
+  return pimpl->parseParallel(from, num, threads);
+}
+
 void TextParser::setFileType(FileType* type)
 {
   pimpl->setFileType(type);
@@ -37,3 +52,33 @@ void TextParser::setMaxBlockSize(int max_block_size)
 {
   pimpl->setMaxBlockSize(max_block_size);
 }
+
+bool TextParser::saveCache(std::ostream& out)
+{
+  return pimpl->saveCache(out);
+}
+
+int TextParser::loadCache(std::istream& in)
+{
+  return pimpl->loadCache(in);
+}
+
+void TextParser::setCheckpointInterval(int lines)
+{
+  pimpl->setCheckpointInterval(lines);
+}
+
+void TextParser::setLineMemoSize(size_t lines)
+{
+  pimpl->setLineMemoSize(lines);
+}
+
+void TextParser::setSkipNoMatch(bool skip)
+{
+  pimpl->setSkipNoMatch(skip);
+}
+
+LineMemoStats TextParser::getLineMemoStats() const
+{
+  return pimpl->getLineMemoStats();
+}
@@ -1,4 +1,6 @@
 #include "colorer/parsers/TextParserHelpers.h"
+#include <algorithm>
+#include <vector>
 
 /////////////////////////////////////////////////////////////////////////
 // parser's cache structures
@@ -7,21 +9,28 @@ ParseCache::~ParseCache()
 {
   //COLORER_LOG_DEEPTRACE("[TPCache] ~ParseCache():%,%-%", *scheme->getName(), sline, eline);
   delete backLine;
-  delete children;
   prev = nullptr;
 
+  // deletes children and next entries without recursion, entries could be nested deeply
+  std::vector<ParseCache*> entries;
+  if (children) {
+    entries.push_back(children);
+  }
   if (next) {
-    ParseCache* tmp;
-    tmp = next;
-    while (tmp->next) {
-      tmp = tmp->next;
+    entries.push_back(next);
+  }
+  while (!entries.empty()) {
+    ParseCache* entry = entries.back();
+    entries.pop_back();
+    if (entry->children) {
+      entries.push_back(entry->children);
     }
-    while (tmp->prev) {
-      tmp = tmp->prev;
-      delete tmp->next;
-      tmp->next = nullptr;
+    if (entry->next) {
+      entries.push_back(entry->next);
     }
-    delete next;
+    entry->children = nullptr;
+    entry->next = nullptr;
+    delete entry;
   }
 
   delete[] vcache;
@@ -29,27 +38,50 @@ ParseCache::~ParseCache()
 
 ParseCache* ParseCache::searchLine(int ln, ParseCache** cache)
 {
-  ParseCache *r1 = nullptr, *r2 = nullptr, *tmp = this;
+  ParseCache* result = nullptr;
   *cache = nullptr;
+  ParseCache* tmp = this;
+  // goes down into children of the entry with the line
   while (tmp) {
     COLORER_LOG_DEEPTRACE("[TPCache] searchLine() tmp:%,%-%", *tmp->scheme->getName(), tmp->sline, tmp->eline);
     if (tmp->sline <= ln && tmp->eline >= ln) {
-      if (tmp->children) {
-        r1 = tmp->children->searchLine(ln, &r2);
-      }
-      if (r1) {
-        *cache = r2;
-        return r1;
-      }
-      *cache = r2;  // last child
-      return tmp;
+      result = tmp;
+      *cache = nullptr;  // last child
+      tmp = tmp->children;
+      continue;
     }
-    if (tmp->sline <= ln) {
-      *cache = tmp;
+    // entries of the level are ordered by their start lines
+    if (tmp->sline > ln) {
+      break;
     }
+    *cache = tmp;
     tmp = tmp->next;
   }
-  return nullptr;
+  return result;
+}
+
+bool ParseCache::isSameState(const ParseCache& other) const
+{
+  if (this == &other) {
+    return true;
+  }
+  if (clender != other.clender || scheme != other.scheme || sline != other.sline ||
+      !(matchstart == other.matchstart))
+  {
+    return false;
+  }
+  if ((backLine || other.backLine) &&
+      (!backLine || !other.backLine || backLine->compare(*other.backLine) != 0))
+  {
+    return false;
+  }
+  if (!vcache || !other.vcache) {
+    return vcache == other.vcache;
+  }
+  int i = 0;
+  for (; vcache[i] && vcache[i] == other.vcache[i]; i++) {
+  }
+  return vcache[i] == other.vcache[i];
 }
 
 /////////////////////////////////////////////////////////////////////////
@@ -143,6 +175,34 @@ void VTList::clear()
   last = this;
 }
 
+void VTList::getEntries(std::vector<const VirtualEntryVector*>& entries) const
+{
+  if (last == this) {
+    return;
+  }
+  for (const VTList* list = this->next; list; list = list->next) {
+    entries.push_back(list->vlist);
+    if (list == this->last) {
+      break;
+    }
+  }
+}
+
+int VTList::getState(std::vector<std::pair<const VirtualEntryVector*, int>>& lists) const
+{
+  std::vector<const VTList*> nodes {this};
+  for (const VTList* list = this->next; list; list = list->next) {
+    nodes.push_back(list);
+  }
+  auto position = [&nodes](const VTList* list) {
+    return list ? static_cast<int>(std::find(nodes.begin(), nodes.end(), list) - nodes.begin()) : -1;
+  };
+  for (size_t i = 1; i < nodes.size(); i++) {
+    lists.emplace_back(nodes[i]->vlist, position(nodes[i]->shadowlast));
+  }
+  return position(last);
+}
+
 VirtualEntryVector** VTList::store()
 {
   if (!nodesnum || last == this) {
@@ -10,6 +10,8 @@
 #define MATCH_NOTHING 0
 #define MATCH_RE 1
 #define MATCH_SCHEME 2
+// block is started, its content is colorized in the new frame
+#define MATCH_BLOCK 3
 
 #define LINE_NEXT 0
 #define LINE_REPARSE 1
@@ -34,7 +36,20 @@ class VTList
   bool pop();
   SchemeImpl* pushvirt(SchemeImpl* scheme);
   void popvirt();
+  /** There are virtual entries, which pushvirt() could apply. */
+  [[nodiscard]] bool hasVirtual() const
+  {
+    return last != this;
+  }
   void clear();
+  /** Appends the lists of virtual entries, which pushvirt() could apply, from the first one. */
+  void getEntries(std::vector<const VirtualEntryVector*>& entries) const;
+  /** Appends all lists of virtual entries from the first one, each with the position of
+      the last list, which is hidden by pushvirt() with it, or -1.
+      Positions are counted from 1, 0 is the root of the list.
+      @return Position of the last list, which pushvirt() could apply.
+  */
+  int getState(std::vector<std::pair<const VirtualEntryVector*, int>>& lists) const;
   VirtualEntryVector** store();
   bool restore(VirtualEntryVector** store);
 };
@@ -68,9 +83,10 @@ class ParseCache
   /**
    * RE Match object for start RE of the enwrapped <block> object
    */
-  SMatches matchstart = {};
+  CompactMatches matchstart;
   /**
    * Copy of the line with parent's start RE.
+   * nullptr, if the end RE of the block doesn't reference the start RE.
    */
   UnicodeString* backLine = nullptr;
 
@@ -90,6 +106,10 @@ class ParseCache
    * @return       Cache entry, assigned to the specified line number
    */
   ParseCache* searchLine(int ln, ParseCache** cache);
+  /**
+   * Checks, that the parser state in this entry is the same, as in @c other.
+   */
+  bool isSameState(const ParseCache& other) const;
 };
 
 #endif
@@ -1,4 +1,11 @@
 #include "colorer/parsers/TextParserImpl.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include "colorer/parsers/ParseCacheStorage.h"
 
 TextParser::Impl::Impl()
 {
@@ -18,6 +25,7 @@ void TextParser::Impl::setFileType(FileType* type)
     baseScheme = (SchemeImpl*) (type->getBaseScheme());
   }
   initCache();
+  clearLineMemo();
 }
 
 void TextParser::Impl::setLineSource(LineSource* lh)
@@ -32,6 +40,12 @@ void TextParser::Impl::setRegionHandler(RegionHandler* rh)
 
 int TextParser::Impl::parse(int from, int num, TextParseMode mode)
 {
+  // the kept state is continued by the parse from the line after it
+  bool resume = suspended && mode == suspendedMode && from == suspendedLine;
+  if (!resume) {
+    dropSuspended();
+  }
+
   gx = 0;
   current_parse_line = from;
   end_line4parse = from + num;
@@ -40,7 +54,10 @@ int TextParser::Impl::parse(int from, int num, TextParseMode mode)
   invisibleSchemesFilled = false;
   schemeStart = -1;
   breakParsing = false;
-  updateCache = (mode == TextParseMode::TPM_CACHE_UPDATE);
+  updateCache = (mode == TextParseMode::TPM_CACHE_UPDATE || mode == TextParseMode::TPM_CACHE_APPEND);
+  appendParse = (mode == TextParseMode::TPM_CACHE_APPEND);
+  suspendedMode = mode;
+  budgetFrom = from;
 
   COLORER_LOG_DEEPTRACE("[TextParserImpl] parse from=%, num=%", from, num);
   /* Check for initial bad conditions */
@@ -48,56 +65,87 @@ int TextParser::Impl::parse(int from, int num, TextParseMode mode)
     return from;
   }
 
-  vtlist = new VTList();
+  if (!resume) {
+    vtlist = new VTList();
+  }
 
   lineSource->startJob(from);
   regionHandler->startParsing(from);
 
-  /* Init cache */
-  parent = cache;
-  forward = nullptr;
-  cache->scheme = baseScheme;
+  // entries after the line are changed, but entries at the line stay in the cache
+  if (updateCache && checkpointInterval > 0 &&
+      checkpoints.size() > static_cast<size_t>(from / checkpointInterval + 1))
+  {
+    checkpoints.resize(from / checkpointInterval + 1);
+  }
+
+  if (!resume) {
+    /* Init cache */
+    parent = cache;
+    forward = nullptr;
+    cache->scheme = baseScheme;
 
-  if (mode == TextParseMode::TPM_CACHE_READ || mode == TextParseMode::TPM_CACHE_UPDATE) {
-    parent = cache->searchLine(from, &forward);
-    if (parent != nullptr) {
-      COLORER_LOG_DEEPTRACE("[TPCache] searchLine() parent:%,%-%", *parent->scheme->getName(),
-                           parent->sline, parent->eline);
+    if (mode != TextParseMode::TPM_CACHE_OFF) {
+      parent = searchCache(from, &forward);
+      if (parent != nullptr) {
+        COLORER_LOG_DEEPTRACE("[TPCache] searchLine() parent:%,%-%", *parent->scheme->getName(),
+                             parent->sline, parent->eline);
+        if (convergeFrom >= 0) {
+          detachOldCache();
+        }
+      }
     }
+    COLORER_LOG_DEEPTRACE("[TextParserImpl] parse: cache filled");
   }
-  COLORER_LOG_DEEPTRACE("[TextParserImpl] parse: cache filled");
 
+  suspended = false;
   do {
-    if (!forward) {
-      if (!parent) {
-        return from;
-      }
-      if (updateCache) {
-        delete parent->children;
-        parent->children = nullptr;
-      }
+    if (resume) {
+      // frames of the kept state are continued
+      resume = false;
+      baseScheme = suspendedScheme;
+      len = -1;
     }
     else {
-      if (updateCache) {
-        delete forward->next;
-        forward->next = nullptr;
+      if (!forward) {
+        if (!parent) {
+          return from;
+        }
+        if (updateCache && convergeLine < 0) {
+          delete parent->children;
+          parent->children = nullptr;
+        }
       }
-    }
-    baseScheme = parent->scheme;
+      else {
+        if (updateCache && convergeLine < 0) {
+          delete forward->next;
+          forward->next = nullptr;
+        }
+      }
+      baseScheme = parent->scheme;
 
-    stackLevel = 0;
-    COLORER_LOG_DEEPTRACE("[TextParserImpl] parse: goes into colorize()");
+      COLORER_LOG_DEEPTRACE("[TextParserImpl] parse: goes into colorize()");
+      if (parent != cache) {
+        vtlist->restore(parent->vcache);
+        end_backstr = parent->backLine;
+        parent->matchstart.restore(cached_backtrace);
+        end_backtrace = &cached_backtrace;
+        initFrames(parent->clender->end.get(), parent->clender->lowContentPriority);
+      }
+      else {
+        initFrames(nullptr, false);
+      }
+    }
+    if (!colorize()) {
+      // the state is kept after the last line
+      break;
+    }
     if (parent != cache) {
-      vtlist->restore(parent->vcache);
-      parent->clender->end->setBackTrace(parent->backLine, &parent->matchstart);
-      colorize(parent->clender->end.get(), parent->clender->lowContentPriority);
       vtlist->clear();
     }
-    else {
-      colorize(nullptr, false);
-    }
 
-    if (updateCache) {
+    // entries after the converged line keep the old end lines
+    if (updateCache && convergeLine < 0) {
       if (parent != cache) {
         parent->eline = current_parse_line;
       }
@@ -110,17 +158,520 @@ int TextParser::Impl::parse(int from, int num, TextParseMode mode)
     forward = parent;
     parent = parent->parent;
   } while (parent);
+  if (updateCache && convergeLine < 0) {
+    cacheEnd = endLine + 1;
+  }
   regionHandler->endParsing(endLine);
   lineSource->endJob(endLine);
-  delete vtlist;
+  if (!suspended) {
+    delete vtlist;
+    vtlist = nullptr;
+  }
   return endLine;
 }
 
+int TextParser::Impl::parse(int from, int num, TextParseMode mode, const ParseBudget& budget)
+{
+  parseBudget = &budget;
+  try {
+    parse(from, num, mode);
+  } catch (...) {
+    parseBudget = nullptr;
+    throw;
+  }
+  parseBudget = nullptr;
+  // the append parse keeps the state after the last line too
+  if (suspended && suspendedLine < from + num) {
+    return suspendedLine;
+  }
+  return from + num;
+}
+
+int TextParser::Impl::reparseLines(int from, int to, int num, int* damagedEnd)
+{
+  convergeFrom = to + 1;
+  convergeLine = -1;
+  int end_line;
+  try {
+    end_line = parse(from, num, TextParseMode::TPM_CACHE_UPDATE);
+  } catch (...) {
+    for (auto* entry : detached) {
+      delete entry;
+    }
+    detached.clear();
+    convergeFrom = -1;
+    throw;
+  }
+  // old cache entries, which are not spliced into the new cache
+  for (auto* entry : detached) {
+    delete entry;
+  }
+  detached.clear();
+  oldLevels.clear();
+  convergeFrom = -1;
+
+  *damagedEnd = end_line;
+  if (convergeLine >= 0) {
+    *damagedEnd = convergeLine - 1;
+    end_line = cacheEnd - 1;
+    convergeLine = -1;
+  }
+  return end_line;
+}
+
+/** Line source of the chunk parsers, it passes only getLine() calls into the source of the text.
+*/
+class ChunkLineSource : public LineSource
+{
+ public:
+  explicit ChunkLineSource(LineSource* source_) : source(source_) {}
+
+  UnicodeString* getLine(size_t lno) override
+  {
+    return source->getLine(lno);
+  }
+
+ private:
+  LineSource* source;
+};
+
+/** Region handler of the chunk parser, which keeps calls of the lines until the chunk is checked.
+*/
+class TextParser::Impl::ChunkRecorder : public RegionHandler
+{
+ public:
+  /** Sets the chunk, which receives the calls for its lines. */
+  void setChunk(ParallelChunk* chunk_)
+  {
+    chunk = chunk_;
+  }
+
+  void clearLine(size_t lno, UnicodeString* /*line*/) override;
+  void addRegion(size_t lno, UnicodeString* /*line*/, int sx, int ex, const Region* region) override
+  {
+    getEvents(lno).push_back({LineEvent::Type::ADD_REGION, sx, ex, region, nullptr});
+  }
+  void enterScheme(size_t lno, UnicodeString* /*line*/, int sx, int ex, const Region* region,
+                   const Scheme* scheme) override
+  {
+    getEvents(lno).push_back(
+        {LineEvent::Type::ENTER_SCHEME, sx, ex, region, static_cast<const SchemeImpl*>(scheme)});
+  }
+  void leaveScheme(size_t lno, UnicodeString* /*line*/, int sx, int ex, const Region* region,
+                   const Scheme* scheme) override
+  {
+    getEvents(lno).push_back(
+        {LineEvent::Type::LEAVE_SCHEME, sx, ex, region, static_cast<const SchemeImpl*>(scheme)});
+  }
+
+ private:
+  ParallelChunk* chunk = nullptr;
+
+  std::vector<LineEvent>& getEvents(size_t lno);
+};
+
+struct TextParser::Impl::ParallelChunk
+{
+  // lines of the chunk
+  int from = 0;
+  int to = 0;
+  std::unique_ptr<Impl> parser;
+  ChunkRecorder recorder;
+  // region handler calls of the lines
+  std::vector<std::vector<LineEvent>> lines;
+  // states of the parser at the lines from + i * PARALLEL_STATE_INTERVAL
+  std::vector<ParseState> states;
+  // the chunk is parsed by its parser, guarded by the mutex of parseParallel()
+  bool done = false;
+  std::exception_ptr error;
+};
+
+void TextParser::Impl::ChunkRecorder::clearLine(size_t lno, UnicodeString* /*line*/)
+{
+  // the line is parsed again
+  getEvents(lno).clear();
+}
+
+std::vector<TextParser::Impl::LineEvent>& TextParser::Impl::ChunkRecorder::getEvents(size_t lno)
+{
+  return chunk->lines[lno - chunk->from];
+}
+
+int TextParser::Impl::parseParallel(int from, int num, int threads)
+{
+  const int chunk_count = std::min(threads * PARALLEL_THREAD_CHUNKS, num / PARALLEL_CHUNK_LINES);
+  if (threads < 2 || chunk_count < 2) {
+    return parse(from, num, TextParseMode::TPM_CACHE_OFF);
+  }
+  if (!regionHandler || !lineSource || !baseScheme) {
+    return from;
+  }
+  dropSuspended();
+
+  ChunkLineSource chunk_source(lineSource);
+  std::vector<std::unique_ptr<ParallelChunk>> chunks;
+  for (int i = 0; i < chunk_count; i++) {
+    auto chunk = std::make_unique<ParallelChunk>();
+    chunk->from = from + static_cast<int>(static_cast<int64_t>(num) * i / chunk_count);
+    chunk->to = from + static_cast<int>(static_cast<int64_t>(num) * (i + 1) / chunk_count);
+    chunk->lines.resize(chunk->to - chunk->from);
+    chunk->recorder.setChunk(chunk.get());
+    chunk->parser = std::make_unique<Impl>();
+    Impl* parser = chunk->parser.get();
+    parser->baseScheme = baseScheme;
+    parser->lineSource = &chunk_source;
+    parser->regionHandler = &chunk->recorder;
+    parser->maxBlockSize = maxBlockSize;
+    parser->lineMemoSize = lineMemoSize;
+    parser->skipNoMatchEnabled = skipNoMatchEnabled;
+    // the right schemes of the previous lines are passed by the previous chunks
+    parser->reportKeptFrames = false;
+    chunks.push_back(std::move(chunk));
+  }
+
+  std::mutex mutex;
+  std::condition_variable chunk_done;
+  std::atomic<size_t> next_chunk {0};
+  auto parse_chunks = [&]() {
+    for (size_t i = next_chunk++; i < chunks.size(); i = next_chunk++) {
+      ParallelChunk& chunk = *chunks[i];
+      try {
+        chunk.parser->parseChunk(chunk, i + 1 == chunks.size());
+      } catch (...) {
+        chunk.error = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        chunk.done = true;
+      }
+      chunk_done.notify_all();
+    }
+  };
+
+  /** Stops the threads before the chunks are freed, also on the exception. */
+  struct Workers
+  {
+    std::vector<std::thread> threads;
+    std::atomic<size_t>& next_chunk;
+    size_t chunk_count;
+
+    ~Workers()
+    {
+      next_chunk = chunk_count;
+      for (auto& thread : threads) {
+        thread.join();
+      }
+    }
+  } workers {{}, next_chunk, chunks.size()};
+  for (int i = 0; i < threads; i++) {
+    workers.threads.emplace_back(parse_chunks);
+  }
+
+  lineSource->startJob(from);
+  regionHandler->startParsing(from);
+  // chunk, which parser has the right state at the end of the passed lines
+  ParallelChunk* right = nullptr;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    ParallelChunk& chunk = *chunks[i];
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      chunk_done.wait(lock, [&chunk] { return chunk.done; });
+    }
+    if (chunk.error) {
+      std::rethrow_exception(chunk.error);
+    }
+    if (right) {
+      right->recorder.setChunk(&chunk);
+      if (right->parser->continueChunk(chunk, i + 1 == chunks.size()) < chunk.to) {
+        // the following lines are parsed by the chunk parser in the same state
+        right->parser.reset();
+        right = &chunk;
+      }
+      else {
+        chunk.parser.reset();
+      }
+    }
+    else {
+      right = &chunk;
+    }
+    for (int line = chunk.from; line < chunk.to; line++) {
+      UnicodeString* line_str = lineSource->getLine(line);
+      regionHandler->clearLine(line, line_str);
+      replayEvents(line, line_str, chunk.lines[line - chunk.from]);
+    }
+    std::vector<std::vector<LineEvent>>().swap(chunk.lines);
+    chunk.states.clear();
+  }
+  const int end_line = right->parser->endLine;
+  regionHandler->endParsing(end_line);
+  lineSource->endJob(end_line);
+  return end_line;
+}
+
+/** Parses the lines of the chunk from the base scheme of the text.
+    States of the parser are kept at every PARALLEL_STATE_INTERVAL lines,
+    the parser keeps its state at the end of the chunk, if it is not the last one.
+*/
+void TextParser::Impl::parseChunk(ParallelChunk& chunk, bool last)
+{
+  ParseBudget budget;
+  for (int line = chunk.from; line < chunk.to;) {
+    chunk.states.emplace_back();
+    getState(chunk.states.back());
+    budget.lines = std::min(PARALLEL_STATE_INTERVAL, chunk.to - line);
+    line = parse(line, chunk.to - line + (last ? 0 : 1), TextParseMode::TPM_CACHE_OFF, budget);
+  }
+}
+
+/** Continues the kept parse through the lines of the chunk,
+    until the state of the parser is equal to the state of the chunk parser at the same line.
+    @return Line, where the states are equal, or the end of the chunk.
+*/
+int TextParser::Impl::continueChunk(ParallelChunk& chunk, bool last)
+{
+  ParseBudget budget;
+  ParseState state;
+  size_t i = 0;
+  for (int line = chunk.from; line < chunk.to; i++) {
+    getState(state);
+    if (state == chunk.states[i]) {
+      return line;
+    }
+    budget.lines = std::min(PARALLEL_STATE_INTERVAL, chunk.to - line);
+    line = parse(line, chunk.to - line + (last ? 0 : 1), TextParseMode::TPM_CACHE_OFF, budget);
+  }
+  return chunk.to;
+}
+
 void TextParser::Impl::initCache()
 {
+  dropSuspended();
   delete cache;
   cache = new ParseCache();
   cache->eline = 0x7FFFFFF;
+  cacheEnd = 0;
+  checkpoints.clear();
+}
+
+bool TextParser::Impl::saveCache(std::ostream& out)
+{
+  if (!baseScheme || !lineSource) {
+    return false;
+  }
+  uint64_t text_hash;
+  lineSource->startJob(0);
+  bool hashed = ParseCacheStorage::hashLines(lineSource, cacheEnd, &text_hash);
+  lineSource->endJob(cacheEnd);
+  if (!hashed) {
+    return false;
+  }
+  ParseCacheStorage storage(baseScheme);
+  storage.write(out, cache, cacheEnd, text_hash);
+  return static_cast<bool>(out);
+}
+
+int TextParser::Impl::loadCache(std::istream& in)
+{
+  if (!baseScheme || !lineSource) {
+    return 0;
+  }
+  ParseCacheStorage storage(baseScheme);
+  int lines;
+  uint64_t stored_hash;
+  if (!storage.readHeader(in, &lines, &stored_hash)) {
+    return 0;
+  }
+  uint64_t text_hash;
+  lineSource->startJob(0);
+  bool hashed = ParseCacheStorage::hashLines(lineSource, lines, &text_hash);
+  lineSource->endJob(lines);
+  if (!hashed || text_hash != stored_hash) {
+    return 0;
+  }
+  initCache();
+  cache->scheme = baseScheme;
+  if (!storage.readEntries(in, cache)) {
+    initCache();
+    return 0;
+  }
+  cacheEnd = lines;
+  return lines;
+}
+
+/** Searches the cache for the line like ParseCache::searchLine,
+    but starts from the nearest checkpoint before the line.
+*/
+ParseCache* TextParser::Impl::searchCache(int ln, ParseCache** forward_)
+{
+  // cache after its end is not complete yet
+  if (checkpointInterval <= 0 || ln < 0 || ln > cacheEnd) {
+    return cache->searchLine(ln, forward_);
+  }
+  const size_t slot = ln / checkpointInterval;
+  while (checkpoints.size() <= slot) {
+    const int line = static_cast<int>(checkpoints.size()) * checkpointInterval;
+    Checkpoint checkpoint {};
+    if (checkpoints.empty()) {
+      checkpoint.entry = cache->searchLine(line, &checkpoint.forward);
+    }
+    else {
+      checkpoint.entry = searchCache(checkpoints.back(), line, &checkpoint.forward);
+    }
+    checkpoints.push_back(checkpoint);
+  }
+  return searchCache(checkpoints[slot], ln, forward_);
+}
+
+/** Searches the cache for the line, which is not before the checkpoint line.
+    Entries, which are ended before the checkpoint line, are skipped.
+*/
+ParseCache* TextParser::Impl::searchCache(const Checkpoint& checkpoint, int ln, ParseCache** forward_)
+{
+  ParseCache* entry = checkpoint.entry;
+  ParseCache* start = checkpoint.forward ? checkpoint.forward : entry->children;
+  // goes up to the entry, which is not ended before the line
+  while (entry->eline < ln && entry->parent) {
+    start = entry;
+    entry = entry->parent;
+  }
+  *forward_ = nullptr;
+  if (!start) {
+    return entry;
+  }
+  ParseCache* result = start->searchLine(ln, forward_);
+  return result ? result : entry;
+}
+
+/** Detaches from the cache entries, which are started after the reparse position.
+    They are kept as the old cache state, while the new state is not converged with it.
+*/
+void TextParser::Impl::detachOldCache()
+{
+  newLevels.clear();
+  for (ParseCache* entry = parent; entry; entry = entry->parent) {
+    newLevels.push_back(entry);
+  }
+  oldLevels.clear();
+  for (size_t i = newLevels.size(); i-- > 0;) {
+    ParseCache* entry = newLevels[i];
+    ParseCache* next_child;
+    if (i > 0) {
+      next_child = newLevels[i - 1]->next;
+      newLevels[i - 1]->next = nullptr;
+    }
+    else if (forward) {
+      next_child = forward->next;
+      forward->next = nullptr;
+    }
+    else {
+      next_child = entry->children;
+      entry->children = nullptr;
+    }
+    if (next_child) {
+      next_child->prev = nullptr;
+      detached.push_back(next_child);
+    }
+    oldLevels.push_back({entry, entry->eline, next_child});
+  }
+}
+
+/** Checks at the start of the line, that the chain of open cache entries is the same,
+    as it was in the old cache. Then the old cache is spliced into the new one.
+*/
+bool TextParser::Impl::checkConvergence()
+{
+  const int line = current_parse_line;
+  if (convergeFrom < 0 || convergeLine >= 0 || line < convergeFrom || line >= cacheEnd ||
+      oldLevels.empty())
+  {
+    return false;
+  }
+
+  // moves the old chain to the line
+  while (oldLevels.size() > 1 && oldLevels.back().eline < line) {
+    oldLevels.pop_back();
+  }
+  while (true) {
+    OldLevel& level = oldLevels.back();
+    ParseCache* open = nullptr;
+    while (level.nextChild && level.nextChild->sline <= line) {
+      ParseCache* child = level.nextChild;
+      level.nextChild = child->next;
+      if (child->eline >= line) {
+        open = child;
+        break;
+      }
+    }
+    if (!open) {
+      break;
+    }
+    oldLevels.push_back({open, open->eline, open->children});
+  }
+
+  if (forward && forward->parent != parent) {
+    return false;
+  }
+  newLevels.clear();
+  for (ParseCache* entry = parent; entry; entry = entry->parent) {
+    newLevels.push_back(entry);
+  }
+  const size_t count = newLevels.size();
+  if (count != oldLevels.size()) {
+    return false;
+  }
+  for (size_t i = 1; i < count; i++) {
+    if (!newLevels[count - 1 - i]->isSameState(*oldLevels[i].entry)) {
+      return false;
+    }
+  }
+  spliceOldCache();
+  convergeLine = line;
+  return true;
+}
+
+/** Moves the old cache entries after the converged line into the new cache.
+*/
+void TextParser::Impl::spliceOldCache()
+{
+  const size_t count = oldLevels.size();
+  std::vector<ParseCache*> tails;
+  for (size_t i = 0; i < count; i++) {
+    ParseCache* owner = newLevels[count - 1 - i];
+    if (i > 0) {
+      owner->eline = oldLevels[i].eline;
+    }
+    ParseCache* tail = oldLevels[i].nextChild;
+    if (!tail) {
+      continue;
+    }
+    if (tail->prev) {
+      tail->prev->next = nullptr;
+    }
+    else if (tail->parent->children == tail) {
+      tail->parent->children = nullptr;
+    }
+    ParseCache* last = i + 1 < count ? newLevels[count - 2 - i] : forward;
+    if (last) {
+      last->next = tail;
+    }
+    else {
+      owner->children = tail;
+    }
+    tail->prev = last;
+    if (owner != oldLevels[i].entry) {
+      for (ParseCache* entry = tail; entry; entry = entry->next) {
+        entry->parent = owner;
+      }
+    }
+    tails.push_back(tail);
+  }
+  for (auto* entry : detached) {
+    if (std::find(tails.begin(), tails.end(), entry) == tails.end()) {
+      delete entry;
+    }
+  }
+  detached.clear();
+  oldLevels.clear();
 }
 
 void TextParser::Impl::breakParse()
@@ -133,16 +684,25 @@ void TextParser::Impl::addRegion(int lno, int sx, int ex, const Region* region)
   if (sx == -1 || region == nullptr) {
     return;
   }
+  if (lineRecording) {
+    recordEvent(LineEvent::Type::ADD_REGION, lno, sx, ex, region);
+  }
   regionHandler->addRegion(lno, str, sx, ex, region);
 }
 
 void TextParser::Impl::enterScheme(int lno, int sx, int ex, const Region* region)
 {
+  if (lineRecording) {
+    recordEvent(LineEvent::Type::ENTER_SCHEME, lno, sx, ex, region);
+  }
   regionHandler->enterScheme(lno, str, sx, ex, region, baseScheme);
 }
 
 void TextParser::Impl::leaveScheme(int lno, int sx, int ex, const Region* region)
 {
+  if (lineRecording) {
+    recordEvent(LineEvent::Type::LEAVE_SCHEME, lno, sx, ex, region);
+  }
   regionHandler->leaveScheme(lno, str, sx, ex, region, baseScheme);
 }
 
@@ -186,12 +746,14 @@ void TextParser::Impl::leaveScheme(int /*lno*/, const SMatches* match,
 
 void TextParser::Impl::fillInvisibleSchemes(ParseCache* ch)
 {
-  if (!ch->parent || ch == cache) {
-    return;
+  std::vector<const ParseCache*> blocks;
+  for (; ch->parent && ch != cache; ch = ch->parent) {
+    blocks.push_back(ch);
+  }
+  /* Fills output stream with valid "pseudo" enterScheme, from the outer block */
+  for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+    enterScheme(current_parse_line, 0, 0, (*it)->clender->region);
   }
-  /* Fills output stream with valid "pseudo" enterScheme */
-  fillInvisibleSchemes(ch->parent);
-  enterScheme(current_parse_line, 0, 0, ch->clender->region);
 }
 
 int TextParser::Impl::searchKW(const SchemeNodeKeywords* node, int /*no*/, int lowlen,
@@ -205,71 +767,25 @@ int TextParser::Impl::searchKW(const SchemeNodeKeywords* node, int /*no*/, int l
     return MATCH_NOTHING;
   }
 
-  int left = 0;
-  int right = node->kwList->count;
-  while (true) {
-    int pos = left + (right - left) / 2;
-    int kwlen = node->kwList->kwList[pos].keyword->length();
-    if (lowlen < gx + kwlen) {
-      kwlen = lowlen - gx;
-    }
-
-    int8_t compare_result;
-    if (node->kwList->matchCase) {
-      compare_result = node->kwList->kwList[pos].keyword->compare(UnicodeString(*str, gx, kwlen));
-    }
-    else {
-      compare_result =
-          UStr::caseCompare(*node->kwList->kwList[pos].keyword, UnicodeString(*str, gx, kwlen));
-    }
-
-    if (compare_result == 0 && right - left == 1) {
-      bool badbound = false;
-      if (!node->kwList->kwList[pos].isSymbol) {
-        if (!node->worddiv) {
-          // default word bound
-          if ((gx > 0 && (Character::isLetterOrDigit((*str)[gx - 1]) || (*str)[gx - 1] == L'_')) ||
-              (gx + kwlen < lowlen &&
-               (Character::isLetterOrDigit((*str)[gx + kwlen]) || (*str)[gx + kwlen] == L'_')))
-          {
-            badbound = true;
-          }
-        }
-        else {
-          // custom check for word bound
-          if ((gx > 0 && !node->worddiv->contains((*str)[gx - 1])) ||
-              (gx + kwlen < lowlen && !node->worddiv->contains((*str)[gx + kwlen])))
-          {
-            badbound = true;
-          }
-        }
-      }
-      if (!badbound) {
-        COLORER_LOG_DEEPTRACE("[TextParserImpl] KW matched. gx=%, region=%", gx,
-                             node->kwList->kwList[pos].region->getName());
-        addRegion(current_parse_line, gx, gx + kwlen, node->kwList->kwList[pos].region);
-        gx += kwlen;
-        return MATCH_RE;
-      }
-    }
-    if (right - left == 1) {
-      left = node->kwList->kwList[pos].indexOfShorter;
-      if (left != -1) {
-        right = left + 1;
-        continue;
-      }
-      break;
-    }
-    if (compare_result == 1) {
-      right = pos;
-    }
-    else {  // if (compare_result == 0 || compare_result == -1)
-      left = pos;
+  const KeywordList* kw_list = node->kwList.get();
+  for (int pos = kw_list->findLongest(*str, gx, lowlen); pos != -1; pos = kw_list->kwList[pos].indexOfShorter) {
+    const KeywordInfo& keyword = kw_list->kwList[pos];
+    if (SchemeKeywords::isBound(node, keyword, *str, gx, lowlen)) {
+      return matchKW(keyword);
     }
   }
   return MATCH_NOTHING;
 }
 
+int TextParser::Impl::matchKW(const KeywordInfo& keyword)
+{
+  const int kwlen = keyword.keyword->length();
+  COLORER_LOG_DEEPTRACE("[TextParserImpl] KW matched. gx=%, region=%", gx, keyword.region->getName());
+  addRegion(current_parse_line, gx, gx + kwlen, keyword.region);
+  gx += kwlen;
+  return MATCH_RE;
+}
+
 int TextParser::Impl::searchIN(SchemeNodeInherit* node, int no, int lowLen, int hiLen)
 {
   // Если для inherit схемы не задана реализация, то ничего не делаем.
@@ -289,22 +805,35 @@ int TextParser::Impl::searchIN(SchemeNodeInherit* node, int no, int lowLen, int
     // парсим текст по имплементации текущего inherit
     re_result = searchMatch(node->scheme, no, lowLen, hiLen);
     if (b) {
-      // достаем inherit из списка, больше он не нужен
-      vtlist->pop();
+      // inherit остается в списке, пока разбирается найденный блок
+      if (re_result == MATCH_BLOCK) {
+        frames[depth - 1]->vtPushes.push_back(true);
+      }
+      else {
+        // достаем inherit из списка, больше он не нужен
+        vtlist->pop();
+      }
     }
   }
   else {
     // нашли замену, по ней далее парсим текст
     re_result = searchMatch(ssubst, no, lowLen, hiLen);
-    vtlist->popvirt();
+    if (re_result == MATCH_BLOCK) {
+      frames[depth - 1]->vtPushes.push_back(false);
+    }
+    else {
+      vtlist->popvirt();
+    }
   }
   return re_result;
 }
 
 int TextParser::Impl::searchRE(SchemeNodeRegexp* node, int /*no*/, int lowLen, int hiLen)
 {
-  SMatches match {};
-  if (!node->start->parse(str, gx, node->lowPriority ? lowLen : hiLen, &match, schemeStart)) {
+  SMatches match;
+  if (!node->start->parse(str, gx, node->lowPriority ? lowLen : hiLen, &match, &match_context,
+                          schemeStart))
+  {
     return MATCH_NOTHING;
   }
   COLORER_LOG_DEEPTRACE("[TextParserImpl] RE matched. gx=%", gx);
@@ -334,8 +863,11 @@ int TextParser::Impl::searchBL(SchemeNodeBlock* node, int no, int lowLen, int hi
   }
 
   // проверяем совпадение по регулярному выражению start
-  SMatches match {};
-  if (!node->start->parse(str, gx, node->lowPriority ? lowLen : hiLen, &match, schemeStart)) {
+  ParseFrame* frame = nextFrame();
+  SMatches& match = frame->match;
+  if (!node->start->parse(str, gx, node->lowPriority ? lowLen : hiLen, &match, &match_context,
+                          schemeStart))
+  {
     return MATCH_NOTHING;
   }
 
@@ -354,7 +886,8 @@ int TextParser::Impl::searchBL(SchemeNodeBlock* node, int no, int lowLen, int hi
   ParseCache* ResF = nullptr;
   ParseCache* ResP = nullptr;
 
-  auto* backLine = new UnicodeString(*str);
+  // the line is copied only, if the block is not ended in it
+  UnicodeString* backLine = node->end->hasBackTrace() ? str : nullptr;
   if (updateCache) {
     ResF = forward;
     ResP = parent;
@@ -378,79 +911,183 @@ int TextParser::Impl::searchBL(SchemeNodeBlock* node, int no, int lowLen, int hi
     OldCacheF->sline = current_parse_line + 1;
     OldCacheF->eline = 0x7FFFFFFF;
     OldCacheF->scheme = ssubst;
-    OldCacheF->matchstart = match;
+    OldCacheF->matchstart.store(match);
     OldCacheF->clender = node;
-    OldCacheF->backLine = backLine;
+    OldCacheF->vcache = vtlist->store();
   }
 
+  frame->node = node;
+  frame->endRe = node->end.get();
+  frame->lowContentPriority = node->lowContentPriority;
+  frame->substituted = ssubst != node->scheme;
+  frame->lineStarted = false;
+  frame->startLine = current_parse_line;
+  frame->startGx = gx;
+  const ParseFrame* parentFrame = frames[depth - 1].get();
+  frame->stalled = 0;
+  if (parentFrame->startLine == current_parse_line && parentFrame->startGx == gx) {
+    frame->stalled = parentFrame->stalled + 1;
+  }
+  frame->backLine = backLine;
+  frame->backLineBorrowed = backLine != nullptr;
+  if (backLine) {
+    borrowedFrames.push_back(depth);
+    borrowedLine = current_parse_line;
+  }
+  frame->searchPath.clear();
+  frame->vtPushes.clear();
+  frame->cacheF = OldCacheF;
+  frame->cacheP = OldCacheP;
+  frame->resF = ResF;
+  frame->resP = ResP;
+
   // сохраняем текущие значения ...
   // .. переменных текущего экземпляра класса
-  auto old_gy = current_parse_line;
-  auto old_scheme = baseScheme;
-  auto old_schemeStart = schemeStart;
-  auto old_matchend = matchend;
-
-  // ... переменных регулярного выражения end блока
-  SMatches* old_reg_match;
-  UnicodeString* old_reg_str;
-  auto scheme_end = node->end.get();
-  scheme_end->getBackTrace((const UnicodeString**) &old_reg_str, &old_reg_match);
+  frame->oldScheme = baseScheme;
+  frame->oldSchemeStart = schemeStart;
+  frame->oldMatchend = matchend;
+  // ... обратных ссылок регулярного выражения end блока
+  frame->oldBackstr = end_backstr;
+  frame->oldBacktrace = end_backtrace;
 
   // задаем новые значения
   baseScheme = ssubst;
   schemeStart = gx;
-  scheme_end->setBackTrace(backLine, &match);
+  end_backstr = backLine;
+  end_backtrace = &match;
+  depth++;
+  if (lineRecording) {
+    recorded.nestedDepth = std::max(recorded.nestedDepth, depth - recordDepth);
+  }
 
   enterScheme(no, &match, node);
-  colorize(scheme_end, node->lowContentPriority);
+  // содержимое блока разбирается в colorize() по новому фрейму
+  len = -1;
+  return MATCH_BLOCK;
+}
+
+/** Copies the lines of the block starts, which are borrowed by the open frames,
+    before the parser leaves the line.
+*/
+void TextParser::Impl::copyBorrowedLines()
+{
+  for (const size_t index : borrowedFrames) {
+    if (index >= depth || !frames[index]->backLineBorrowed) {
+      continue;
+    }
+    ParseFrame* frame = frames[index].get();
+    auto* copy = new UnicodeString(*frame->backLine);
+    // the line is referenced as the back trace of the frame and as the saved state of the next one
+    if (index + 1 < depth && frames[index + 1]->oldBackstr == frame->backLine) {
+      frames[index + 1]->oldBackstr = copy;
+    }
+    if (index + 1 == depth) {
+      end_backstr = copy;
+    }
+    frame->backLine = copy;
+    frame->backLineBorrowed = false;
+    if (frame->cacheF) {
+      frame->cacheF->backLine = copy;
+    }
+  }
+  borrowedFrames.clear();
+  borrowedLine = -1;
+}
+
+/** Finishes the frame on the top of the stack. For the block frame returns the result of
+    the search in the parent frame, as searchMatch() would return it with the block node.
+*/
+int TextParser::Impl::leaveBlock()
+{
+  ParseFrame* frame = frames[--depth].get();
+  // the block of the recorded line is ended
+  if (lineRecording && depth < recordDepth) {
+    lineRecording = false;
+  }
+  SchemeNodeBlock* node = frame->node;
+  if (!node) {
+    return MATCH_NOTHING;
+  }
+  ParseFrame* parentFrame = frames[depth - 1].get();
+  const auto old_gy = parentFrame->searchLine;
 
   if (current_parse_line < end_line4parse) {
     leaveScheme(current_parse_line, &matchend, node);
   }
   gx = matchend.e[0];
   /* (empty-block.test) Check if the consumed scheme is zero-length */
-  bool zeroLength = (match.s[0] == matchend.e[0] && old_gy == current_parse_line);
+  bool zeroLength = (frame->match.s[0] == matchend.e[0] && old_gy == current_parse_line);
 
   // восстанавливаем старые значения
-  scheme_end->setBackTrace(old_reg_str, old_reg_match);
-  matchend = old_matchend;
-  schemeStart = old_schemeStart;
-  baseScheme = old_scheme;
+  end_backstr = frame->oldBackstr;
+  end_backtrace = frame->oldBacktrace;
+  matchend = frame->oldMatchend;
+  schemeStart = frame->oldSchemeStart;
+  baseScheme = frame->oldScheme;
 
   if (updateCache) {
     if (old_gy == current_parse_line) {
-      delete OldCacheF;
-      if (ResF) {
-        ResF->next = nullptr;
+      delete frame->cacheF;
+      if (frame->resF) {
+        frame->resF->next = nullptr;
       }
-      else if (ResP) {
-        ResP->children = nullptr;
+      else if (frame->resP) {
+        frame->resP->children = nullptr;
       }
-      forward = ResF;
-      parent = ResP;
+      forward = frame->resF;
+      parent = frame->resP;
     }
     else {
-      OldCacheF->eline = current_parse_line;
-      OldCacheF->vcache = vtlist->store();
-      forward = OldCacheF;
-      parent = OldCacheP;
+      if (convergeLine < 0) {
+        frame->cacheF->eline = current_parse_line;
+      }
+      // parsing is broken in the line of the block start
+      if (frame->backLineBorrowed) {
+        frame->cacheF->backLine = new UnicodeString(*frame->backLine);
+      }
+      forward = frame->cacheF;
+      parent = frame->cacheP;
     }
   }
-  else {
-    delete backLine;
+  else if (!frame->backLineBorrowed) {
+    delete frame->backLine;
   }
-  if (ssubst != node->scheme) {
+  frame->backLine = nullptr;
+  frame->backLineBorrowed = false;
+
+  // the search to the block node is left now
+  if (frame->substituted) {
     vtlist->popvirt();
   }
+  for (const bool pushed : frame->vtPushes) {
+    if (pushed) {
+      vtlist->pop();
+    }
+    else {
+      vtlist->popvirt();
+    }
+  }
 
   /* (empty-block.test) skips block if it has zero length and spread over single line */
   if (zeroLength) {
-    return MATCH_NOTHING;
+    // continues the search with the nodes after the block node
+    resumePath.assign(frame->searchPath.rbegin(), frame->searchPath.rend());
+    resumeLevel = 0;
+    resumeGx = parentFrame->searchGx;
+    return searchMatch(baseScheme, old_gy, parentFrame->searchLowLen, parentFrame->searchHiLen);
   }
 
   return MATCH_SCHEME;
 }
 
+TextParser::Impl::ParseFrame* TextParser::Impl::nextFrame()
+{
+  if (depth == frames.size()) {
+    frames.push_back(std::make_unique<ParseFrame>());
+  }
+  return frames[depth].get();
+}
+
 int TextParser::Impl::searchMatch(const SchemeImpl* cscheme, int no, int lowLen, int hiLen)
 {
   COLORER_LOG_DEEPTRACE("[TextParserImpl] searchMatch: entered scheme \"%\"", *cscheme->getName());
@@ -458,11 +1095,26 @@ int TextParser::Impl::searchMatch(const SchemeImpl* cscheme, int no, int lowLen,
   if (!cscheme) {
     return MATCH_NOTHING;
   }
-#ifdef COLORER_USE_DEEPTRACE
-  int idx = 0;
-#endif
-  for (auto const& schemeNode : cscheme->nodes) {
-    COLORER_LOG_DEEPTRACE("[TextParserImpl] searchMatch: processing node:%/%, type:%", idx + 1,
+  // the search after the zero-length block continues with the candidates of its position
+  const bool resume = resumeLevel < resumePath.size();
+  const auto& candidates =
+      cscheme->prefilter.getCandidates(*str, resume ? resumeGx : gx, !vtlist->hasVirtual());
+  size_t i = 0;
+  if (resume) {
+    i = resumePath[resumeLevel++];
+    if (resumeLevel == resumePath.size()) {
+      // the block node itself is done
+      resumePath.clear();
+      resumeLevel = 0;
+      i++;
+    }
+  }
+  SchemeKeywords::Match kw_match;
+  bool kw_searched = false;
+  for (; i < candidates.size(); i++) {
+    const int node_no = candidates[i];
+    auto const& schemeNode = cscheme->nodes[node_no];
+    COLORER_LOG_DEEPTRACE("[TextParserImpl] searchMatch: processing node:%/%, type:%", node_no + 1,
                          cscheme->nodes.size(),
                          SchemeNode::schemeNodeTypeNames[static_cast<int>(schemeNode->type)]);
     switch (schemeNode->type) {
@@ -470,12 +1122,29 @@ int TextParser::Impl::searchMatch(const SchemeImpl* cscheme, int no, int lowLen,
         auto schemeNodeInherit = static_cast<SchemeNodeInherit*>(schemeNode.get());
         int re_result = searchIN(schemeNodeInherit, no, lowLen, hiLen);
         if (re_result != MATCH_NOTHING) {
+          if (re_result == MATCH_BLOCK) {
+            frames[depth - 1]->searchPath.push_back(static_cast<int>(i));
+          }
           return re_result;
         }
         break;
       }
       case SchemeNode::SchemeNodeType::SNT_KEYWORDS: {
         auto schemeNodeKe = static_cast<SchemeNodeKeywords*>(schemeNode.get());
+        if (cscheme->keywords.isBuilt()) {
+          // keywords of all nodes are searched at the first keyword node
+          if (!kw_searched) {
+            kw_match = cscheme->keywords.find(cscheme->nodes, *str, gx, lowLen);
+            kw_searched = true;
+          }
+          if (kw_match.node == node_no) {
+            return matchKW(schemeNodeKe->kwList->kwList[kw_match.keyword]);
+          }
+          // earlier node is not tried by the resumed search, so the node is searched by itself
+          if (kw_match.node == -1 || kw_match.node > node_no) {
+            break;
+          }
+        }
         if (searchKW(schemeNodeKe, no, lowLen, hiLen) == MATCH_RE) {
           return MATCH_RE;
         }
@@ -490,115 +1159,484 @@ int TextParser::Impl::searchMatch(const SchemeImpl* cscheme, int no, int lowLen,
       }
       case SchemeNode::SchemeNodeType::SNT_BLOCK: {
         auto schemeNodeBlock = static_cast<SchemeNodeBlock*>(schemeNode.get());
-        if (searchBL(schemeNodeBlock, no, lowLen, hiLen) != MATCH_NOTHING) {
-          return MATCH_SCHEME;
+        if (searchBL(schemeNodeBlock, no, lowLen, hiLen) == MATCH_BLOCK) {
+          frames[depth - 1]->searchPath.push_back(static_cast<int>(i));
+          return MATCH_BLOCK;
         }
         break;
       }
     }
-#ifdef COLORER_USE_DEEPTRACE
-    idx++;
-#endif
   }
   return MATCH_NOTHING;
 }
 
-bool TextParser::Impl::colorize(CRegExp* root_end_re, bool lowContentPriority)
+/** Checks, that any node of the scheme or of inherited schemes could match at the position,
+    inherited schemes are taken with virtual substitutions, as searchIN() does.
+*/
+bool TextParser::Impl::mayMatch(const SchemeImpl* cscheme, int pos)
 {
-  len = -1;
-
-  /* Direct check for recursion level */
-  if (stackLevel > MAX_RECURSION_LEVEL) {
-    return true;
+  if (!cscheme) {
+    return false;
   }
-  stackLevel++;
-
-  for (; current_parse_line < end_line4parse;) {
-    COLORER_LOG_DEEPTRACE("[TextParserImpl] colorize: line no %", current_parse_line);
-    // clears line at start,
-    // prevents multiple requests on each line
-    if (clearLine != current_parse_line) {
-      clearLine = current_parse_line;
-      str = lineSource->getLine(current_parse_line);
-      if (str == nullptr) {
-        throw Exception("null String passed into the parser: " +
-                        UStr::to_unistr(current_parse_line));
-      }
-      regionHandler->clearLine(current_parse_line, str);
+  const bool no_virtual = !vtlist->hasVirtual();
+  const auto& candidates = cscheme->prefilter.getCandidates(*str, pos, no_virtual);
+  // linked lists already filter inherit nodes by the inherited schemes
+  if (no_virtual && cscheme->prefilter.isLinked()) {
+    return !candidates.empty();
+  }
+  for (const int node_no : candidates) {
+    const auto& schemeNode = cscheme->nodes[node_no];
+    if (schemeNode->type != SchemeNode::SchemeNodeType::SNT_INHERIT) {
+      return true;
     }
-    // hack to include invisible regions in start of block
-    // when parsing with cache information
-    if (!invisibleSchemesFilled) {
-      invisibleSchemesFilled = true;
-      fillInvisibleSchemes(parent);
+    auto schemeNodeInherit = static_cast<SchemeNodeInherit*>(schemeNode.get());
+    if (!schemeNodeInherit->scheme) {
+      continue;
     }
-    // updates length
-    if (len < 0) {
-      len = str->length();
+    bool result;
+    SchemeImpl* ssubst = vtlist->pushvirt(schemeNodeInherit->scheme);
+    if (!ssubst) {
+      bool b = vtlist->push(schemeNodeInherit);
+      result = mayMatch(schemeNodeInherit->scheme, pos);
+      if (b) {
+        vtlist->pop();
+      }
     }
-    endLine = current_parse_line;
-
-    // searches for the end of parent block
-    int res = 0;
-    if (root_end_re) {
-      res = root_end_re->parse(str, gx, len, &matchend, schemeStart);
+    else {
+      result = mayMatch(ssubst, pos);
+      vtlist->popvirt();
     }
-    if (!res) {
-      matchend.s[0] = matchend.e[0] = gx + maxBlockSize > len ? len : gx + maxBlockSize;
+    if (result) {
+      return true;
     }
+  }
+  return false;
+}
 
-    int parent_len = len;
-    /*
-    BUG: <regexp match="/.{3}\M$/" region="def:Error" priority="low"/>
-    $ at the end of current schema
-    */
-    if (lowContentPriority) {
-      len = matchend.s[0];
+/** Returns the first position in [from, to], where the scheme could match, or to + 1.
+    Positions, where searchMatch() could only return MATCH_NOTHING, are skipped.
+*/
+int TextParser::Impl::skipNoMatch(const SchemeImpl* cscheme, int from, int to)
+{
+  for (; from <= to; from++) {
+    if (mayMatch(cscheme, from)) {
+      break;
     }
+  }
+  return from;
+}
 
-    int ret = LINE_NEXT;
-    for (; gx <= matchend.s[0];) {  //    '<' or '<=' ???
-      if (breakParsing) {
-        current_parse_line = end_line4parse;
-        break;
+/** Starts the frame stack with the root frame, which content is colorized until the end RE.
+*/
+void TextParser::Impl::initFrames(CRegExp* root_end_re, bool lowContentPriority)
+{
+  len = -1;
+  depth = 0;
+  ParseFrame* frame = nextFrame();
+  frame->node = nullptr;
+  frame->endRe = root_end_re;
+  frame->lowContentPriority = lowContentPriority;
+  frame->lineStarted = false;
+  frame->startLine = -1;
+  frame->startGx = -1;
+  frame->stalled = 0;
+  depth++;
+  borrowedFrames.clear();
+  borrowedLine = -1;
+  lineRecording = false;
+}
+
+/** Colorizes the text by the frames, started by initFrames().
+    @return false, if the frames are kept open for the next parse, see suspendParse().
+*/
+bool TextParser::Impl::colorize()
+{
+  while (depth > 0) {
+    ParseFrame* frame = frames[depth - 1].get();
+    bool finished = false;
+    if (!frame->lineStarted) {
+      if (borrowedLine >= 0 && borrowedLine != current_parse_line) {
+        copyBorrowedLines();
       }
-      int old_current_parse_line = current_parse_line;
-      int re_result =
-          searchMatch(baseScheme, current_parse_line, matchend.s[0],
-                      matchend.s[0] + maxBlockSize > len ? len : matchend.s[0] + maxBlockSize);
-      if ((re_result == MATCH_SCHEME &&
-           (old_current_parse_line != current_parse_line || matchend.s[0] < gx)) ||
-          (re_result == MATCH_RE && matchend.s[0] < gx))
+      /* Direct check for nesting level */
+      if (current_parse_line >= end_line4parse || depth > MAX_BLOCK_DEPTH ||
+          frame->stalled > MAX_STALLED_BLOCKS)
       {
-        len = -1;
-        ret = LINE_REPARSE;
-        break;
+        // blocks are kept open for the parse of the following lines
+        if (appendParse && current_parse_line == end_line4parse && !breakParsing) {
+          suspendParse();
+          return false;
+        }
+        finished = true;
+      }
+      else if (clearLine != current_parse_line && checkConvergence()) {
+        // the following lines are parsed already
+        current_parse_line = end_line4parse;
+        finished = true;
+      }
+      else if (clearLine != current_parse_line && budgetSpent()) {
+        // the next parse continues from the line
+        suspendParse();
+        return false;
+      }
+      else {
+        COLORER_LOG_DEEPTRACE("[TextParserImpl] colorize: line no %", current_parse_line);
+        const bool new_line = clearLine != current_parse_line;
+        // clears line at start,
+        // prevents multiple requests on each line
+        if (new_line) {
+          clearLine = current_parse_line;
+          str = lineSource->getLine(current_parse_line);
+          if (str == nullptr) {
+            throw Exception("null String passed into the parser: " +
+                            UStr::to_unistr(current_parse_line));
+          }
+          // blocks of the kept frames have no cache entries, if the cache is not updated,
+          // they are open before the line, as in the parse, which is not stopped
+          if (!invisibleSchemesFilled && !updateCache && reportKeptFrames) {
+            for (size_t i = 1; i < depth; i++) {
+              enterScheme(current_parse_line, 0, 0, frames[i]->node->region);
+            }
+          }
+          regionHandler->clearLine(current_parse_line, str);
+        }
+        // hack to include invisible regions in start of block
+        // when parsing with cache information
+        if (!invisibleSchemesFilled) {
+          invisibleSchemesFilled = true;
+          fillInvisibleSchemes(parent);
+        }
+        // the line, started in the frame, could be parsed already in the same state
+        const bool memo_line = new_line && lineMemoSize > 0 && gx == 0 && schemeStart == -1;
+        if (memo_line && replayLine(frame)) {
+          endLine = current_parse_line;
+          len = -1;
+          current_parse_line++;
+          continue;
+        }
+        // updates length
+        if (len < 0) {
+          len = str->length();
+        }
+        endLine = current_parse_line;
+
+        // searches for the end of parent block
+        int res = 0;
+        if (frame->endRe) {
+          match_context.setBackTrace(end_backstr, end_backtrace);
+          res = frame->endRe->parse(str, gx, len, &matchend, &match_context, schemeStart);
+          match_context.setBackTrace(nullptr, nullptr);
+        }
+        if (!res) {
+          matchend.s[0] = matchend.e[0] = gx + maxBlockSize > len ? len : gx + maxBlockSize;
+        }
+        frame->endFound = res;
+        if (memo_line && !res) {
+          lineRecording = true;
+          recordLine = current_parse_line;
+          recordDepth = depth;
+          recorded.nestedDepth = 0;
+          recorded.events.clear();
+        }
+
+        frame->parentLen = len;
+        /*
+        BUG: <regexp match="/.{3}\M$/" region="def:Error" priority="low"/>
+        $ at the end of current schema
+        */
+        if (frame->lowContentPriority) {
+          len = matchend.s[0];
+        }
+        frame->lineStarted = true;
+        continue;
       }
-      if (old_current_parse_line == current_parse_line) {
-        len = parent_len;
+    }
+    else if (gx > matchend.s[0] || breakParsing) {  //    '<' or '<=' ???
+      if (gx <= matchend.s[0]) {
+        current_parse_line = end_line4parse;
       }
-      if (re_result == MATCH_NOTHING) {
-        gx++;
+      schemeStart = -1;
+      if (frame->endFound) {
+        finished = true;
       }
+      else {
+        if (lineRecording) {
+          storeLine();
+        }
+        len = -1;
+        current_parse_line++;
+        gx = 0;
+        frame->lineStarted = false;
+        continue;
+      }
+    }
+
+    int re_result;
+    if (finished) {
+      re_result = leaveBlock();
+      if (depth == 0) {
+        break;
+      }
+      frame = frames[depth - 1].get();
     }
-    if (ret == LINE_REPARSE) {
+    else {
+      frame->searchLine = current_parse_line;
+      frame->searchGx = gx;
+      frame->searchLowLen = matchend.s[0];
+      frame->searchHiLen = matchend.s[0] + maxBlockSize > len ? len : matchend.s[0] + maxBlockSize;
+      re_result = searchMatch(baseScheme, current_parse_line, frame->searchLowLen, frame->searchHiLen);
+    }
+    if (re_result == MATCH_BLOCK) {
       continue;
     }
 
-    schemeStart = -1;
-    if (res) {
-      stackLevel--;
-      return true;
+    if ((re_result == MATCH_SCHEME &&
+         (frame->searchLine != current_parse_line || matchend.s[0] < gx)) ||
+        (re_result == MATCH_RE && matchend.s[0] < gx))
+    {
+      // reparses the line of the frame
+      len = -1;
+      frame->lineStarted = false;
+      continue;
+    }
+    if (frame->searchLine == current_parse_line) {
+      len = frame->parentLen;
+    }
+    if (re_result == MATCH_NOTHING) {
+      // the end of parent block is searched already, so only scheme nodes are checked
+      gx = skipNoMatchEnabled ? skipNoMatch(baseScheme, gx + 1, matchend.s[0]) : gx + 1;
     }
-    len = -1;
-    current_parse_line++;
-    gx = 0;
   }
-  stackLevel--;
   return true;
 }
 
+/** Keeps the state of the parser after the last line of the append parse,
+    or before the line, where the budget of the parse is spent.
+    Open cache entries are ended at the line, like they are ended by the completed parse.
+*/
+void TextParser::Impl::suspendParse()
+{
+  if (updateCache && convergeLine < 0) {
+    for (ParseCache* entry = parent; entry && entry != cache; entry = entry->parent) {
+      entry->eline = current_parse_line;
+    }
+  }
+  lineRecording = false;
+  suspended = true;
+  suspendedLine = current_parse_line;
+  // the base scheme of the text is restored, as the completed parse does
+  suspendedScheme = baseScheme;
+  baseScheme = cache->scheme;
+}
+
+/** Checks the limits of the parse at the start of the line, the first line is always parsed.
+*/
+bool TextParser::Impl::budgetSpent() const
+{
+  if (!parseBudget || current_parse_line == budgetFrom) {
+    return false;
+  }
+  if (parseBudget->lines > 0 && current_parse_line - budgetFrom >= parseBudget->lines) {
+    return true;
+  }
+  return parseBudget->deadline != std::chrono::steady_clock::time_point::max() &&
+         std::chrono::steady_clock::now() >= parseBudget->deadline;
+}
+
+void TextParser::Impl::dropSuspended()
+{
+  if (suspended) {
+    suspended = false;
+    delete vtlist;
+    vtlist = nullptr;
+  }
+}
+
+/** Fills the state of the parser at the line, where the kept parse is continued,
+    or the state at the start of the text, if the parser has no kept state.
+*/
+void TextParser::Impl::getState(ParseState& state) const
+{
+  state.blocks.clear();
+  state.virtualLists.clear();
+  state.virtualLast = 0;
+  if (!suspended) {
+    return;
+  }
+  for (size_t i = 1; i < depth; i++) {
+    const ParseFrame* frame = frames[i].get();
+    ParseState::Block& block = state.blocks.emplace_back();
+    block.node = frame->node;
+    block.scheme = i + 1 < depth ? frames[i + 1]->oldScheme : suspendedScheme;
+    block.substituted = frame->substituted;
+    block.vtPushes = frame->vtPushes;
+    block.oldSchemeStart = frame->oldSchemeStart;
+    block.backTraced = frame->backLine != nullptr;
+    if (block.backTraced) {
+      block.backLine = *frame->backLine;
+      block.backtrace.store(frame->match);
+    }
+  }
+  state.virtualLast = vtlist->getState(state.virtualLists);
+}
+
+bool TextParser::Impl::ParseState::Block::operator==(const Block& other) const
+{
+  return node == other.node && scheme == other.scheme && substituted == other.substituted &&
+         vtPushes == other.vtPushes && oldSchemeStart == other.oldSchemeStart &&
+         backTraced == other.backTraced &&
+         (!backTraced || (backLine == other.backLine && backtrace == other.backtrace));
+}
+
+bool TextParser::Impl::ParseState::operator==(const ParseState& other) const
+{
+  return blocks == other.blocks && virtualLists == other.virtualLists && virtualLast == other.virtualLast;
+}
+
 void TextParser::Impl::setMaxBlockSize(int max_block_size)
 {
   maxBlockSize = max_block_size;
+  clearLineMemo();
+}
+
+void TextParser::Impl::setCheckpointInterval(int lines)
+{
+  checkpointInterval = lines;
+  checkpoints.clear();
+}
+
+void TextParser::Impl::setLineMemoSize(size_t lines)
+{
+  lineMemoSize = lines;
+  clearLineMemo();
+}
+
+void TextParser::Impl::setSkipNoMatch(bool skip)
+{
+  skipNoMatchEnabled = skip;
+}
+
+LineMemoStats TextParser::Impl::getLineMemoStats() const
+{
+  LineMemoStats stats = lineMemoStats;
+  stats.size = lineMemo.size();
+  return stats;
+}
+
+bool TextParser::Impl::LineState::operator==(const LineState& other) const
+{
+  return scheme == other.scheme && endRe == other.endRe &&
+         lowContentPriority == other.lowContentPriority && virtualEntries == other.virtualEntries &&
+         backTraced == other.backTraced &&
+         (!backTraced || (backLine == other.backLine && backtrace == other.backtrace));
+}
+
+static void combineHash(size_t& hash, size_t value)
+{
+  hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+}
+
+/** Searches the current line in the memo by the state of the frame, which starts the line.
+    Found regions are passed to the region handler. Otherwise the state of the line is kept
+    in the recorded entry.
+*/
+bool TextParser::Impl::replayLine(const ParseFrame* frame)
+{
+  LineState& state = recorded.state;
+  state.scheme = baseScheme;
+  state.endRe = frame->endRe;
+  state.lowContentPriority = frame->lowContentPriority;
+  state.virtualEntries.clear();
+  vtlist->getEntries(state.virtualEntries);
+  state.backTraced = frame->endRe && frame->endRe->hasBackTrace() && end_backstr && end_backtrace;
+  if (state.backTraced) {
+    state.backLine = *end_backstr;
+    state.backtrace.store(*end_backtrace);
+  }
+
+  size_t hash = std::hash<UnicodeString>()(*str);
+  combineHash(hash, std::hash<const void*>()(state.scheme));
+  combineHash(hash, std::hash<const void*>()(state.endRe));
+  combineHash(hash, state.lowContentPriority);
+  for (const auto* entries : state.virtualEntries) {
+    combineHash(hash, std::hash<const void*>()(entries));
+  }
+  if (state.backTraced) {
+    combineHash(hash, std::hash<UnicodeString>()(state.backLine));
+  }
+  recorded.hash = hash;
+
+  auto found = lineMemoIndex.find(hash);
+  if (found == lineMemoIndex.end() || found->second->line != *str || !(found->second->state == state) ||
+      depth + found->second->nestedDepth > MAX_BLOCK_DEPTH)
+  {
+    lineMemoStats.misses++;
+    return false;
+  }
+  lineMemoStats.hits++;
+  lineMemo.splice(lineMemo.begin(), lineMemo, found->second);
+  replayEvents(current_parse_line, str, lineMemo.front().events);
+  return true;
+}
+
+/** Passes the recorded calls of the line to the region handler.
+*/
+void TextParser::Impl::replayEvents(int lno, UnicodeString* line, const std::vector<LineEvent>& events)
+{
+  for (const auto& event : events) {
+    switch (event.type) {
+      case LineEvent::Type::ADD_REGION:
+        regionHandler->addRegion(lno, line, event.sx, event.ex, event.region);
+        break;
+      case LineEvent::Type::ENTER_SCHEME:
+        regionHandler->enterScheme(lno, line, event.sx, event.ex, event.region, event.scheme);
+        break;
+      case LineEvent::Type::LEAVE_SCHEME:
+        regionHandler->leaveScheme(lno, line, event.sx, event.ex, event.region, event.scheme);
+        break;
+    }
+  }
+}
+
+void TextParser::Impl::recordEvent(LineEvent::Type type, int lno, int sx, int ex, const Region* region)
+{
+  if (lno != recordLine) {
+    lineRecording = false;
+    return;
+  }
+  recorded.events.push_back({type, sx, ex, region, baseScheme});
+}
+
+/** Keeps the recorded line in the memo, if the parser has reached the end of the line
+    in the frame, which has started it.
+*/
+void TextParser::Impl::storeLine()
+{
+  lineRecording = false;
+  if (depth != recordDepth || current_parse_line != recordLine || breakParsing ||
+      recordDepth + recorded.nestedDepth > MAX_BLOCK_DEPTH)
+  {
+    return;
+  }
+  auto found = lineMemoIndex.find(recorded.hash);
+  if (found != lineMemoIndex.end()) {
+    lineMemo.erase(found->second);
+    lineMemoIndex.erase(found);
+  }
+  recorded.line = *str;
+  lineMemo.push_front(std::move(recorded));
+  lineMemoIndex[lineMemo.front().hash] = lineMemo.begin();
+  recorded = LineMemoEntry();
+  while (lineMemo.size() > lineMemoSize) {
+    lineMemoIndex.erase(lineMemo.back().hash);
+    lineMemo.pop_back();
+  }
+}
+
+void TextParser::Impl::clearLineMemo()
+{
+  lineMemo.clear();
+  lineMemoIndex.clear();
+  lineMemoStats = LineMemoStats();
+  lineRecording = false;
 }
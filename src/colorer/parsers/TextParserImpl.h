@@ -1,10 +1,23 @@
 #ifndef _COLORER_TEXTPARSERIMPL_H_
 #define _COLORER_TEXTPARSERIMPL_H_
 
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 #include "colorer/TextParser.h"
 #include "colorer/parsers/TextParserHelpers.h"
 
-#define MAX_RECURSION_LEVEL 100
+// maximum nesting level of blocks
+#define MAX_BLOCK_DEPTH 10000
+// maximum number of blocks, nested at the same position without moving in the text
+#define MAX_STALLED_BLOCKS 100
+// minimum number of lines in the chunk of the parallel parse
+#define PARALLEL_CHUNK_LINES 1000
+// number of chunks of the parallel parse for each thread
+#define PARALLEL_THREAD_CHUNKS 4
+// lines between the states of the chunk parser, which are compared with the right state
+#define PARALLEL_STATE_INTERVAL 64
 
 /**
  * Implementation of TextParser interface.
@@ -23,13 +36,75 @@ class TextParser::Impl
   void setLineSource(LineSource* lh);
   void setRegionHandler(RegionHandler* rh);
   int parse(int from, int num, TextParseMode mode);
+  int parse(int from, int num, TextParseMode mode, const ParseBudget& budget);
+  int reparseLines(int from, int to, int num, int* damagedEnd);
+  int parseParallel(int from, int num, int threads);
   void breakParse();
   void initCache();
+  bool saveCache(std::ostream& out);
+  int loadCache(std::istream& in);
   void setMaxBlockSize(int max_block_size);
+  void setCheckpointInterval(int lines);
+  void setLineMemoSize(size_t lines);
+  void setSkipNoMatch(bool skip);
+  [[nodiscard]] LineMemoStats getLineMemoStats() const;
 
  private:
+  /** State of the block, which content is colorized. Nested blocks are kept on the
+      heap stack of frames, instead of recursive calls of colorize().
+  */
+  struct ParseFrame
+  {
+    // block, nullptr for the root frame
+    SchemeNodeBlock* node = nullptr;
+    CRegExp* endRe = nullptr;
+    bool lowContentPriority = false;
+    // the scheme of the block is substituted through virtual entry
+    bool substituted = false;
+
+    // start position of the block content
+    int startLine = -1;
+    int startGx = -1;
+    // number of parent blocks with the same start position
+    int stalled = 0;
+
+    // the line is started and the end of the block is searched in it
+    bool lineStarted = false;
+    bool endFound = false;
+    int parentLen = 0;
+
+    // arguments of the last searchMatch() call in the frame
+    int searchLine = 0;
+    int searchGx = 0;
+    int searchLowLen = 0;
+    int searchHiLen = 0;
+
+    // start match of the block and its line for the back trace of the end RE,
+    // nullptr if the end RE has no back trace
+    SMatches match;
+    UnicodeString* backLine = nullptr;
+    // backLine is the current line of the parser, it is copied, when the line is left
+    bool backLineBorrowed = false;
+    // candidate indexes of the nodes to the block node, innermost first
+    std::vector<int> searchPath;
+    // VTList changes of inherit nodes to the block node, true for push(), false for pushvirt()
+    std::vector<bool> vtPushes;
+
+    // state of the parent frame
+    SchemeImpl* oldScheme = nullptr;
+    int oldSchemeStart = -1;
+    SMatches oldMatchend;
+    const UnicodeString* oldBackstr = nullptr;
+    const SMatches* oldBacktrace = nullptr;
+
+    // cache entries, created for the block
+    ParseCache* cacheF = nullptr;
+    ParseCache* cacheP = nullptr;
+    ParseCache* resF = nullptr;
+    ParseCache* resP = nullptr;
+  };
+
   UnicodeString* str = nullptr;
-  int stackLevel = 0;
   int current_parse_line = 0;
   int gx = 0;
   int end_line4parse = 0;
@@ -42,19 +117,170 @@ class TextParser::Impl
   bool breakParsing = false;
   bool invisibleSchemesFilled = false;
   bool updateCache = false;
+  bool appendParse = false;
+  // frames of the TPM_CACHE_APPEND parse are kept after its last line
+  bool suspended = false;
+  // first line after the kept state and the scheme of its top frame
+  int suspendedLine = 0;
+  SchemeImpl* suspendedScheme = nullptr;
+  // the kept state is continued by the parse with the same mode
+  TextParseMode suspendedMode = TextParseMode::TPM_CACHE_APPEND;
+  // limits of the current parse and its first line, nullptr - no limits
+  const ParseBudget* parseBudget = nullptr;
+  int budgetFrom = 0;
+  // schemes of the kept frames are passed to the region handler by the continued parse
+  bool reportKeptFrames = true;
 
   ParseCache* cache = nullptr;
   ParseCache* parent = nullptr;
   ParseCache* forward = nullptr;
+  // lines before it are covered by the cache of TPM_CACHE_UPDATE parses
+  int cacheEnd = 0;
+
+  /** Result of the cache search for the line. */
+  struct Checkpoint
+  {
+    // deepest entry with the line
+    ParseCache* entry;
+    // last child of the entry before the line
+    ParseCache* forward;
+  };
+  // lines between checkpoints, 0 if checkpoints are not used
+  int checkpointInterval = 256;
+  // cache positions for the lines, which are multiples of the interval
+  std::vector<Checkpoint> checkpoints;
+
+  /** Cache entry, which is open at the checked line in the cache before reparse. */
+  struct OldLevel
+  {
+    ParseCache* entry;
+    int eline;
+    // next child of the entry, which is not checked yet
+    ParseCache* nextChild;
+  };
+
+  // lines from it are checked for convergence with the old cache, -1 if not checked
+  int convergeFrom = -1;
+  // line, where the parser state has converged, -1 if not yet
+  int convergeLine = -1;
+  // chain of old cache entries at the checked line, from the root
+  std::vector<OldLevel> oldLevels;
+  // old cache entries after the reparse position, detached from the cache
+  std::vector<ParseCache*> detached;
+  std::vector<ParseCache*> newLevels;
 
   SMatches matchend = {};
   VTList* vtlist = nullptr;
 
+  // regexp match state of this parser
+  MatchContext match_context;
+  // back trace for the end regexp of the current block
+  const UnicodeString* end_backstr = nullptr;
+  const SMatches* end_backtrace = nullptr;
+  // start match of the block, which is restored from the cache
+  SMatches cached_backtrace;
+
+  // frames of colorize(), frames are reused between blocks
+  std::vector<std::unique_ptr<ParseFrame>> frames;
+  size_t depth = 0;
+  // frames, which borrow the line of the start match, and the line
+  std::vector<size_t> borrowedFrames;
+  int borrowedLine = -1;
+  // search path to continue after the zero-length block, outermost first
+  std::vector<int> resumePath;
+  size_t resumeLevel = 0;
+  int resumeGx = 0;
+
+  /** Call of the region handler, made while the line is parsed. */
+  struct LineEvent
+  {
+    enum class Type { ADD_REGION, ENTER_SCHEME, LEAVE_SCHEME };
+    Type type;
+    int sx;
+    int ex;
+    const Region* region;
+    const SchemeImpl* scheme;
+  };
+
+  /** Parser state at the start of the line, which regions of the line depend on. */
+  struct LineState
+  {
+    const SchemeImpl* scheme = nullptr;
+    const CRegExp* endRe = nullptr;
+    bool lowContentPriority = false;
+    std::vector<const VirtualEntryVector*> virtualEntries;
+    // back trace of the end RE, it is used only if the RE has the back trace
+    bool backTraced = false;
+    UnicodeString backLine;
+    CompactMatches backtrace;
+
+    bool operator==(const LineState& other) const;
+  };
+
+  /** State of the parser at the line, where the kept TPM_CACHE_OFF parse is continued.
+      Parses, continued from the equal states, pass the same regions.
+  */
+  struct ParseState
+  {
+    /** Block, which is open at the line. */
+    struct Block
+    {
+      const SchemeNodeBlock* node = nullptr;
+      // scheme of the block content
+      const SchemeImpl* scheme = nullptr;
+      bool substituted = false;
+      std::vector<bool> vtPushes;
+      // scheme start of the parent block, which is restored after the block
+      int oldSchemeStart = -1;
+      // back trace of the end RE, it is kept only if the RE has the back trace
+      bool backTraced = false;
+      UnicodeString backLine;
+      CompactMatches backtrace;
+
+      bool operator==(const Block& other) const;
+    };
+
+    std::vector<Block> blocks;
+    std::vector<std::pair<const VirtualEntryVector*, int>> virtualLists;
+    int virtualLast = 0;
+
+    bool operator==(const ParseState& other) const;
+  };
+
+  /** Lines of parseParallel(), which are parsed by one parser. */
+  struct ParallelChunk;
+  class ChunkRecorder;
+
+  /** Regions of the line, which is parsed without changes of the frame stack. */
+  struct LineMemoEntry
+  {
+    size_t hash = 0;
+    UnicodeString line;
+    LineState state;
+    // nesting level of blocks, which are started and ended in the line
+    size_t nestedDepth = 0;
+    std::vector<LineEvent> events;
+  };
+
+  // maximum number of lines in the memo, 0 if the memo is not used
+  size_t lineMemoSize = 0;
+  // memorized lines, the most recently used first
+  std::list<LineMemoEntry> lineMemo;
+  std::unordered_map<size_t, std::list<LineMemoEntry>::iterator> lineMemoIndex;
+  LineMemoStats lineMemoStats;
+  // line, which events are recorded, and the number of frames at its start
+  bool lineRecording = false;
+  int recordLine = -1;
+  size_t recordDepth = 0;
+  LineMemoEntry recorded;
+
   LineSource* lineSource = nullptr;
   RegionHandler* regionHandler = nullptr;
 
   // maximum block size of regexp in string line
   int maxBlockSize = 1000;
+  // positions, where no scheme node could start, are skipped by the prefilter
+  bool skipNoMatchEnabled = true;
 
   void fillInvisibleSchemes(ParseCache* cache);
   void addRegion(int lno, int sx, int ex, const Region* region);
@@ -64,11 +290,37 @@ class TextParser::Impl
   void leaveScheme(int, const SMatches* match, const SchemeNodeBlock* schemeNode);
 
   int searchKW(const SchemeNodeKeywords* node, int, int lowlen, int);
+  int matchKW(const KeywordInfo& keyword);
   int searchIN(SchemeNodeInherit* node, int no, int lowLen, int hiLen);
   int searchRE(SchemeNodeRegexp* node, int no, int lowLen, int hiLen);
   int searchBL(SchemeNodeBlock* node, int no, int lowLen, int hiLen);
+  int leaveBlock();
+  void copyBorrowedLines();
+  ParseFrame* nextFrame();
   int searchMatch(const SchemeImpl* cscheme, int no, int lowLen, int hiLen);
-  bool colorize(CRegExp* root_end_re, bool lowContentPriority);
+  bool mayMatch(const SchemeImpl* cscheme, int pos);
+  int skipNoMatch(const SchemeImpl* cscheme, int from, int to);
+  void initFrames(CRegExp* root_end_re, bool lowContentPriority);
+  bool colorize();
+  void suspendParse();
+  [[nodiscard]] bool budgetSpent() const;
+  void dropSuspended();
+  void getState(ParseState& state) const;
+  void parseChunk(ParallelChunk& chunk, bool last);
+  int continueChunk(ParallelChunk& chunk, bool last);
+
+  ParseCache* searchCache(int ln, ParseCache** forward_);
+  ParseCache* searchCache(const Checkpoint& checkpoint, int ln, ParseCache** forward_);
+
+  bool replayLine(const ParseFrame* frame);
+  void replayEvents(int lno, UnicodeString* line, const std::vector<LineEvent>& events);
+  void recordEvent(LineEvent::Type type, int lno, int sx, int ex, const Region* region);
+  void storeLine();
+  void clearLineMemo();
+
+  void detachOldCache();
+  bool checkConvergence();
+  void spliceOldCache();
 };
 
 #endif
@@ -40,6 +40,11 @@ UChar Character::toUpperCase(UChar c)
   return (UChar) u_toupper(c);
 }
 
+UChar Character::foldCase(UChar c)
+{
+  return (UChar) u_foldCase(c, U_FOLD_CASE_DEFAULT);
+}
+
 UChar Character::toTitleCase(UChar c)
 {
   return (UChar) u_totitle(c);
@@ -16,6 +16,8 @@ class Character
   static UChar toLowerCase(UChar c);
   static UChar toUpperCase(UChar c);
   static UChar toTitleCase(UChar c);
+  /** Simple case folding of the code unit, surrogates are not changed. */
+  static UChar foldCase(UChar c);
 };
 
 #endif  // COLORER_CHARACTER_H
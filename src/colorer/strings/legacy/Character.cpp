@@ -19,6 +19,11 @@ wchar Character::toUpperCase(wchar c)
   return (wchar)(unsigned short)(c - wchar(c1 >> 16));
 }
 
+wchar Character::foldCase(wchar c)
+{
+  return toLowerCase(c);
+}
+
 wchar Character::toTitleCase(wchar c)
 {
   unsigned long c1 = CHAR_PROP(c);
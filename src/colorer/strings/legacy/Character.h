@@ -30,6 +30,8 @@ public:
   static wchar toLowerCase(wchar c);
   static wchar toUpperCase(wchar c);
   static wchar toTitleCase(wchar c);
+  /** Case folding of the character, the same as toLowerCase(). */
+  static wchar foldCase(wchar c);
 
   static bool isLowerCase(wchar c);
   static bool isUpperCase(wchar c);
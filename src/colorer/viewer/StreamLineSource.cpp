@@ -0,0 +1,214 @@
+#include "colorer/viewer/StreamLineSource.h"
+#include <algorithm>
+#include <cerrno>
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// size of the block, read from the stream
+static const size_t STREAM_BUFFER_SIZE = 0x10000;
+
+StreamLineSource::StreamLineSource(FILE* stream_, bool tab2spaces_)
+    : stream(stream_), tab2spaces(tab2spaces_), buffer(STREAM_BUFFER_SIZE)
+{
+}
+
+size_t StreamLineSource::readLines(size_t count)
+{
+  // the stream is waited only for the first line, the next ones are taken from the read data
+  const size_t kept = lines.size();
+  while (lines.size() < count && (lines.size() == kept || hasReadLine()) && readLine()) {
+  }
+  return lines.size();
+}
+
+void StreamLineSource::releaseLines(size_t lno)
+{
+  while (firstLine < lno && !lines.empty()) {
+    lines.pop_front();
+    firstLine++;
+  }
+}
+
+size_t StreamLineSource::getFirstLine() const
+{
+  return firstLine;
+}
+
+bool StreamLineSource::isEnd() const
+{
+  return ended;
+}
+
+UnicodeString* StreamLineSource::getLine(size_t lno)
+{
+  if (lno < firstLine) {
+    return nullptr;
+  }
+  while (lno - firstLine >= lines.size()) {
+    if (!readLine()) {
+      return nullptr;
+    }
+  }
+  return &lines[lno - firstLine];
+}
+
+bool StreamLineSource::fillBuffer()
+{
+  bufferPos = 0;
+  bufferLen = readStream(buffer.data(), buffer.size());
+  return bufferLen != 0;
+}
+
+/** Reads the bytes, which are received from the stream, and waits for them, only if there are none.
+    @return Number of read bytes, 0 at the end of the stream.
+*/
+size_t StreamLineSource::readStream(char* data, size_t size)
+{
+#ifdef _MSC_VER
+  int read_len = _read(_fileno(stream), data, static_cast<unsigned int>(size));
+#else
+  ssize_t read_len;
+  do {
+    read_len = read(fileno(stream), data, size);
+  } while (read_len < 0 && errno == EINTR);
+#endif
+  return read_len > 0 ? static_cast<size_t>(read_len) : 0;
+}
+
+/** Checks, if the read data has the end of the next line, so it is read without waiting for the stream.
+*/
+bool StreamLineSource::hasReadLine() const
+{
+  if (!started || ended) {
+    return ended;
+  }
+  size_t pos = bufferPos;
+  if (skipLF && pos < bufferLen && buffer[pos] == '\n') {
+    pos++;
+  }
+  return std::any_of(buffer.begin() + pos, buffer.begin() + bufferLen, [](char c) { return c == '\r' || c == '\n'; });
+}
+
+/** Checks, if the bytes could be the start of the Unicode signature.
+*/
+static bool isSignatureStart(const unsigned char* data, size_t len)
+{
+  static const unsigned char signatures[][4] = {
+      {0xEF, 0xBB, 0xBF}, {0xFE, 0xFF}, {0xFF, 0xFE}, {0x00, 0x00, 0xFE, 0xFF}};
+  static const size_t lengths[] = {3, 2, 2, 4};
+  for (size_t i = 0; i < 4; i++) {
+    if (len < lengths[i] && std::equal(data, data + len, signatures[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** Checks the Unicode signature at the start of the stream.
+*/
+void StreamLineSource::start()
+{
+  started = true;
+  // the signature could be read by parts from the pipe, other text is not waited for
+  while (isSignatureStart(reinterpret_cast<const unsigned char*>(buffer.data()), bufferLen)) {
+    size_t read_len = readStream(buffer.data() + bufferLen, buffer.size() - bufferLen);
+    if (read_len == 0) {
+      break;
+    }
+    bufferLen += read_len;
+  }
+  const auto* data = reinterpret_cast<const unsigned char*>(buffer.data());
+  if (bufferLen >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF) {
+    bufferPos = 3;
+  }
+  else if ((bufferLen >= 2 && ((data[0] == 0xFE && data[1] == 0xFF) || (data[0] == 0xFF && data[1] == 0xFE))) ||
+           (bufferLen >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0xFE && data[3] == 0xFF))
+  {
+    readWhole();
+  }
+}
+
+/** Reads and decodes the rest of the stream, which is not in UTF-8.
+*/
+void StreamLineSource::readWhole()
+{
+  std::vector<char> data(buffer.begin(), buffer.begin() + bufferLen);
+  while (fillBuffer()) {
+    data.insert(data.end(), buffer.begin(), buffer.begin() + bufferLen);
+  }
+  bufferPos = bufferLen = 0;
+  ended = true;
+  auto file = Encodings::toUnicodeString(data.data(), static_cast<int32_t>(data.size()));
+  const int32_t length = file->length();
+  int32_t prevpos = 0;
+  for (int32_t filepos = 0; filepos <= length; filepos++) {
+    if (filepos == length || (*file)[filepos] == '\r' || (*file)[filepos] == '\n') {
+      addLine(UnicodeString(*file, prevpos, filepos - prevpos));
+      if (filepos + 1 < length && (*file)[filepos] == '\r' && (*file)[filepos + 1] == '\n') {
+        filepos++;
+      }
+      prevpos = filepos + 1;
+    }
+  }
+}
+
+bool StreamLineSource::readLine()
+{
+  if (!started) {
+    start();
+    // the text with other encoding is read at once
+    if (ended) {
+      return !lines.empty();
+    }
+  }
+  if (ended) {
+    return false;
+  }
+  while (true) {
+    if (bufferPos == bufferLen && !fillBuffer()) {
+      // the rest of the stream is the last line
+      ended = true;
+      addLine(decodeLine());
+      return true;
+    }
+    if (skipLF) {
+      skipLF = false;
+      if (buffer[bufferPos] == '\n') {
+        bufferPos++;
+        continue;
+      }
+    }
+    auto begin = buffer.begin() + bufferPos;
+    auto end = buffer.begin() + bufferLen;
+    auto eol = std::find_if(begin, end, [](char c) { return c == '\r' || c == '\n'; });
+    lineBytes.insert(lineBytes.end(), begin, eol);
+    bufferPos = eol - buffer.begin();
+    if (eol != end) {
+      skipLF = *eol == '\r';
+      bufferPos++;
+      addLine(decodeLine());
+      return true;
+    }
+  }
+}
+
+UnicodeString StreamLineSource::decodeLine()
+{
+  UnicodeString line;
+  if (!lineBytes.empty()) {
+    line = *Encodings::fromUTF8(lineBytes.data(), static_cast<int32_t>(lineBytes.size()));
+    lineBytes.clear();
+  }
+  return line;
+}
+
+void StreamLineSource::addLine(UnicodeString&& line)
+{
+  lines.push_back(std::move(line));
+  if (tab2spaces) {
+    lines.back().findAndReplace("\t", "    ");
+  }
+}
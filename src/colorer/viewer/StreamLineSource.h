@@ -0,0 +1,75 @@
+#ifndef COLORER_STREAMLINESOURCE_H
+#define COLORER_STREAMLINESOURCE_H
+
+#include <cstdio>
+#include <deque>
+#include <vector>
+#include "colorer/LineSource.h"
+
+/** Reads text lines from the stream, while they are requested,
+    and makes them accessible with LineSource interface.
+    Lines should be separated with \\r\\n , \\n or \\r characters, as for TextLinesStore.
+    UTF-8 text is decoded by lines, text with other Unicode signature is read at once.
+    Lines are kept, until they are released, so the memory does not depend
+    on the size of the text, when parsed lines are released.
+    The stream is read by its file descriptor, so the data, which is received from the pipe,
+    is available at once. The stream should not be read with the stdio functions before.
+
+    @ingroup colorer_viewer
+*/
+class StreamLineSource : public LineSource
+{
+ public:
+  /**
+    @param stream Stream to read, it is not closed by the source.
+    @param tab2spaces Points, if we have to convert all tabs in lines into spaces.
+  */
+  StreamLineSource(FILE* stream, bool tab2spaces);
+  ~StreamLineSource() override = default;
+
+  /** Reads lines, until @c count lines are kept, or the stream is ended.
+      The stream is waited only for the first line, the other lines are read,
+      if they are received already.
+      @return Number of kept lines.
+  */
+  size_t readLines(size_t count);
+  /** Frees lines before @c lno.
+  */
+  void releaseLines(size_t lno);
+  /** Returns number of the first kept line. */
+  [[nodiscard]] size_t getFirstLine() const;
+  /** Returns true, when all lines of the stream are read. */
+  [[nodiscard]] bool isEnd() const;
+
+  /** Returns the line, it is read from the stream, if needed.
+      Returns null for released lines and lines after the end of the stream.
+  */
+  UnicodeString* getLine(size_t lno) override;
+
+ private:
+  FILE* stream;
+  bool tab2spaces;
+  std::deque<UnicodeString> lines;
+  size_t firstLine = 0;
+
+  std::vector<char> buffer;
+  size_t bufferPos = 0;
+  size_t bufferLen = 0;
+  // bytes of the line, which is not ended yet
+  std::vector<char> lineBytes;
+  // '\n' after '\r' is the same line separator
+  bool skipLF = false;
+  bool started = false;
+  bool ended = false;
+
+  bool readLine();
+  bool fillBuffer();
+  size_t readStream(char* data, size_t size);
+  [[nodiscard]] bool hasReadLine() const;
+  void start();
+  void readWhole();
+  UnicodeString decodeLine();
+  void addLine(UnicodeString&& line);
+};
+
+#endif  // COLORER_STREAMLINESOURCE_H
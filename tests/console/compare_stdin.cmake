@@ -0,0 +1,27 @@
+# Checks, that the text from the standard input is colored as the same text from the file.
+# Parameters: COLORER - path of the console tool, DATA_DIR - test data, WORK_DIR - directory for the input.
+
+# the text is longer than the part of lines, which is parsed at once from the stream
+file(READ "${DATA_DIR}/nested.nst" lines)
+set(text "")
+foreach(i RANGE 500)
+  string(APPEND text "${lines}")
+endforeach()
+set(input "${WORK_DIR}/input.nst")
+file(WRITE "${input}" "${text}")
+
+set(args -ht -dc -dh -tnested -c "${DATA_DIR}/catalog.xml")
+execute_process(COMMAND "${COLORER}" ${args} "${input}"
+    OUTPUT_VARIABLE file_output RESULT_VARIABLE file_result)
+execute_process(COMMAND "${COLORER}" ${args}
+    INPUT_FILE "${input}" OUTPUT_VARIABLE stdin_output RESULT_VARIABLE stdin_result)
+
+if(NOT file_result EQUAL 0 OR NOT stdin_result EQUAL 0)
+  message(FATAL_ERROR "colorer failed: ${file_result}, ${stdin_result}")
+endif()
+if(NOT file_output MATCHES "nested-word")
+  message(FATAL_ERROR "the text from the file is not colored")
+endif()
+if(NOT file_output STREQUAL stdin_output)
+  message(FATAL_ERROR "the text from the standard input is colored in other way")
+endif()
@@ -1,6 +1,7 @@
 #include <cwchar>
 #include <memory>
 #include "tests.h"
+#include "colorer/cregexp/cregexp.h"
 
 enum JobType { JT_NOTHING, JT_TEST1, JT_TEST2, JT_TEST3, JT_TEST4, JT_TEST5 };
 
@@ -18,7 +19,8 @@ void printError()
            L" Parameters:\n"
            L"  -c<n>      Number of test runs\n"
            L"  -b<path>   Uses specified 'catalog.xml' file\n"
-           L"  -f<path>   Test file\n\n"
+           L"  -f<path>   Test file\n"
+           L"  -e<n>      Regexp engine: 0 - tree, 1 - bytecode, 2 - lazy DFA (default)\n\n"
            L" Test:\n"
            L"   1         TestParserFactoryConstructor\n"
            L"   2         TestParserFactoryHrcLibrary\n"
@@ -48,6 +50,14 @@ int init(int argc, char* argv[])
         loops = 1;
       continue;
     }
+    if (argv[i][1] == L'e') {
+      if (argv[i][2]) {
+        const int engine = atoi(argv[i] + 2);
+        CRegExp::setEngine(engine == 0 ? EEngine::TREE : engine == 1 ? EEngine::BYTECODE : EEngine::DFA);
+      } else
+        return -1;
+      continue;
+    }
     if (argv[i][1] == L'b' && (i + 1 < argc || argv[i][2])) {
       if (argv[i][2]) {
         catalogPath = new UnicodeString(argv[i] + 2);
@@ -0,0 +1,67 @@
+#include <catch2/catch.hpp>
+#include "colorer/ParserFactory.h"
+#include "colorer/editor/BaseEditor.h"
+#include "colorer/utils/FileSystems.h"
+
+class EditorLineSource : public LineSource
+{
+ public:
+  std::vector<UnicodeString> lines;
+
+  UnicodeString* getLine(size_t lno) override
+  {
+    return lno < lines.size() ? &lines[lno] : nullptr;
+  }
+};
+
+/** Returns the regions of the editor lines as the strings "start-end name;".
+*/
+static std::vector<std::string> getEditorRegions(BaseEditor& editor, int count)
+{
+  std::vector<std::string> result;
+  for (int i = 0; i < count; i++) {
+    std::string line;
+    for (LineRegion* region = editor.getLineRegions(i); region; region = region->next) {
+      line += std::to_string(region->start) + "-" + std::to_string(region->end) + " ";
+      if (region->region) {
+        line += UStr::to_stdstr(&region->region->getName());
+      }
+      line += ";";
+    }
+    result.push_back(line);
+  }
+  return result;
+}
+
+TEST_CASE("Parse the modified line after the inserted line")
+{
+  ParserFactory factory;
+  auto work_dir = fs::current_path() / "data/type_nested.hrc";
+  XmlInputSource file1(UnicodeString(work_dir.c_str()), nullptr);
+  factory.getHrcLibrary().loadSource(&file1);
+  auto* type = factory.getHrcLibrary().getFileType(UnicodeString("nestedtext"));
+  REQUIRE(type != nullptr);
+
+  EditorLineSource lines;
+  for (const auto* line : {"a", "b (c", "d", "e", "f g", "h) i", "jj k", "<<E", "l m", "E", "n"}) {
+    lines.lines.emplace_back(line);
+  }
+  BaseEditor editor(&factory, &lines);
+  editor.setFileType(type);
+  editor.lineCountEvent(static_cast<int>(lines.lines.size()));
+  getEditorRegions(editor, static_cast<int>(lines.lines.size()));
+
+  // the line is inserted, then the line before it is modified
+  lines.lines.emplace(lines.lines.begin() + 5, "x (y");
+  editor.modifyEvent(5);
+  const int count = static_cast<int>(lines.lines.size());
+  editor.lineCountEvent(count);
+  lines.lines[3] = UnicodeString("e z");
+  editor.modifyLineEvent(3);
+  editor.validate(-1, false);
+
+  BaseEditor fresh_editor(&factory, &lines);
+  fresh_editor.setFileType(type);
+  fresh_editor.lineCountEvent(count);
+  REQUIRE(getEditorRegions(editor, count) == getEditorRegions(fresh_editor, count));
+}
@@ -0,0 +1,186 @@
+#include <colorer/cregexp/cregexp.h>
+#include <catch2/catch.hpp>
+
+struct RegExpCase
+{
+  const char16_t* pattern;
+  const char16_t* text;
+  bool found;
+  int s;
+  int e;
+};
+
+static const RegExpCase regexp_cases[] = {
+    {u"/\\b(if|else|while)\\b/", u"  while (x)", true, 2, 7},
+    {u"/[a-z_]\\w*/", u"12 foo_1 bar", true, 3, 8},
+    {u"/\\d+(\\.\\d+)?/", u"x = 12.5;", true, 4, 8},
+    {u"/\"((\\\\.)|[^\\\\\"])*?\"/", u"s = \"a\\\"b\" + c", true, 4, 10},
+    {u"/(a|ab)(c|bcd)(d*)/", u"abcd", true, 0, 4},
+    {u"/(?:abc){2,}?/", u"abcabcabc", true, 0, 6},
+    {u"/a(b)?=/", u"acab", true, 2, 3},
+    {u"/a(b)?!/", u"abac", true, 2, 3},
+    {u"/x(?{name}\\w)y\\p{name}/", u"xayb xaya", true, 5, 9},
+    {u"/\\m foo \\M bar/x", u"foobar", true, 0, 3},
+    {u"/^\\s*$/", u"  x", false, 0, 0},
+    {u"/AbC/i", u"xabc", true, 1, 4},
+    {u"/(select|from)\\b/i", u"x FROMs From", true, 8, 12},
+    {u"/\\w+foo/", u"ab. xfoo", true, 4, 8},
+    {u"/(ab)+c/", u"abab abc", true, 5, 8},
+    {u"/\\s*#\\s*define/", u"  #  defin #define", true, 10, 18},
+    {u"/x\\d/", u"x xx xa ax x. x_ x- xx 10 x 1 x x xx1", true, 35, 37},
+    {u"/[\u0430-\u044f]+\\s/", u"abc \u0430\u0431 defgh ijklm nopqr \u0444\u0444 ", true, 4, 7},
+    {u"/k/i", u"abc\u212a", true, 3, 4},
+    {u"/(ask|as)k\\b/i", u"ASKK as\u212a", true, 0, 4},
+    {u"/(a|ab){1,3}?c\\B/", u"abac ababc abcd", true, 11, 14},
+    {u"/~\\s*\\d{2,}$/", u" 42", true, 0, 3},
+    {u"/^\\d+/m", u"ab\n12", true, 3, 5},
+    {u"/stra\u00dfe\\b/i", u"STRASSE Stra\u00dfE", true, 8, 14},
+    {u"/(begin|end)\\s*\\1?END\\b/i", u"BEGIN eNd", true, 0, 9},
+};
+
+/** Restores the engine and the step limit of all RE objects, which are changed by the test.
+*/
+class RegExpSettingsGuard
+{
+ public:
+  RegExpSettingsGuard() : engine(CRegExp::getEngine()), stepLimit(CRegExp::getStepLimit()) {}
+  ~RegExpSettingsGuard()
+  {
+    CRegExp::setEngine(engine);
+    CRegExp::setStepLimit(stepLimit);
+  }
+  RegExpSettingsGuard(const RegExpSettingsGuard&) = delete;
+  RegExpSettingsGuard& operator=(const RegExpSettingsGuard&) = delete;
+
+ private:
+  EEngine engine;
+  int stepLimit;
+};
+
+static void checkRegExpCases()
+{
+  for (const auto& test : regexp_cases) {
+    UnicodeString pattern(test.pattern);
+    UnicodeString text(test.text);
+    INFO("pattern " << UStr::to_stdstr(&pattern));
+    CRegExp re(&pattern);
+    re.setPositionMoves(true);
+    REQUIRE(re.isOk());
+
+    SMatches match {};
+    MatchContext ctx;
+    bool found = re.parse(&text, 0, text.length(), &match, &ctx);
+    REQUIRE(found == test.found);
+    if (found) {
+      REQUIRE(match.s[0] == test.s);
+      REQUIRE(match.e[0] == test.e);
+    }
+  }
+}
+
+TEST_CASE("Match regular expressions")
+{
+  RegExpSettingsGuard guard;
+  SECTION("with lazy DFA engine")
+  {
+    CRegExp::setEngine(EEngine::DFA);
+    checkRegExpCases();
+  }
+  SECTION("with bytecode engine")
+  {
+    CRegExp::setEngine(EEngine::BYTECODE);
+    checkRegExpCases();
+  }
+  SECTION("with tree engine")
+  {
+    CRegExp::setEngine(EEngine::TREE);
+    checkRegExpCases();
+  }
+}
+
+TEST_CASE("Match nested repeats in linear time with lazy DFA")
+{
+  UnicodeString pattern(u"/^(\\w+\\s?)+$/");
+  UnicodeString text(u"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+  UnicodeString bad_text(u"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa!");
+  RegExpSettingsGuard guard;
+  CRegExp::setEngine(EEngine::DFA);
+  CRegExp re(&pattern);
+  REQUIRE(re.isOk());
+  SMatches match {};
+  REQUIRE_FALSE(re.parse(&bad_text, 0, bad_text.length(), &match));
+  REQUIRE(re.parse(&text, 0, text.length(), &match));
+  REQUIRE(match.e[0] == text.length());
+}
+
+TEST_CASE("Stop backtracking at the step limit")
+{
+  UnicodeString pattern(u"/(a|aa)*b/");
+  UnicodeString text(u"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+  UnicodeString short_text(u"aaab");
+  RegExpSettingsGuard guard;
+  CRegExp::setEngine(EEngine::BYTECODE);
+  CRegExp::setStepLimit(10000);
+  CRegExp re(&pattern);
+  REQUIRE(re.isOk());
+  SMatches match {};
+  REQUIRE_FALSE(re.parse(&text, 0, text.length(), &match));
+  REQUIRE(re.getStepLimitHits() == 1);
+  REQUIRE(re.parse(&short_text, 0, short_text.length(), &match));
+  REQUIRE(match.e[0] == 4);
+  REQUIRE(re.getStepLimitHits() == 1);
+}
+
+TEST_CASE("Match at the end of the long line within the default step limit")
+{
+  UnicodeString pattern(u"/\\w(b)?=/");
+  UnicodeString text;
+  const int length = 1200000;
+  for (int i = 0; i < length; i++) {
+    text.append(UnicodeString(u"a"));
+  }
+  text.append(UnicodeString(u"b"));
+  REQUIRE(CRegExp::getStepLimit() == STEP_LIMIT_DEFAULT);
+  CRegExp re(&pattern);
+  re.setPositionMoves(true);
+  REQUIRE(re.isOk());
+  SMatches match {};
+  REQUIRE(re.parse(&text, 0, text.length(), &match));
+  REQUIRE(match.s[0] == length - 1);
+  REQUIRE(match.e[0] == length);
+  REQUIRE(re.getStepLimitHits() == 0);
+}
+
+TEST_CASE("Match back trace from compact match record")
+{
+  UnicodeString start_pattern(u"/<(\\w+)>/");
+  UnicodeString end_pattern(u"/<\\/\\y1\\y3>/");
+  UnicodeString text(u"<tag> text </tag>");
+  CRegExp start_re(&start_pattern);
+  CRegExp end_re;
+  end_re.setPositionMoves(true);
+  end_re.setBackRE(&start_re);
+  end_re.setRE(&end_pattern);
+  REQUIRE(start_re.isOk());
+  REQUIRE(end_re.isOk());
+  REQUIRE(end_re.hasBackTrace());
+  REQUIRE_FALSE(start_re.hasBackTrace());
+  REQUIRE(start_re.getBracketsCount() == 2);
+  REQUIRE(start_re.getNamedBracketsCount() == 0);
+
+  SMatches start_match;
+  REQUIRE(start_re.parse(&text, &start_match));
+  CompactMatches record(start_match);
+  SMatches trace;
+  record.restore(trace);
+  REQUIRE(trace.cMatch == 2);
+  REQUIRE(trace.s[1] == 1);
+  REQUIRE(trace.e[1] == 4);
+
+  SMatches match;
+  MatchContext ctx;
+  ctx.setBackTrace(&text, &trace);
+  REQUIRE(end_re.parse(&text, 5, text.length(), &match, &ctx));
+  REQUIRE(match.s[0] == 11);
+  REQUIRE(match.e[0] == 17);
+}
@@ -1,5 +1,8 @@
 #include <catch2/catch.hpp>
 #include "colorer/parsers/HrcLibraryImpl.h"
+#include "colorer/parsers/KeywordList.h"
+#include "colorer/parsers/SchemeKeywords.h"
+#include "colorer/parsers/SchemePrefilter.h"
 #include "colorer/utils/FileSystems.h"
 
 TEST_CASE("Load hrc")
@@ -10,4 +13,196 @@ TEST_CASE("Load hrc")
   XmlInputSource file1(uwork_dir, nullptr);
   HrcLibrary lib;
   lib.loadSource(&file1);
-}
\ No newline at end of file
+}
+TEST_CASE("Share compiled regexps of equal patterns")
+{
+  auto work_dir = fs::current_path() / "data/type_regexp.hrc";
+  auto uwork_dir = UnicodeString(work_dir.c_str());
+  XmlInputSource file1(uwork_dir, nullptr);
+  HrcLibrary lib;
+  lib.loadSource(&file1);
+  auto* type = lib.getFileType(UnicodeString("regexp"));
+  REQUIRE(type != nullptr);
+  lib.loadFileType(type);
+
+  auto stats = lib.getRegExpCacheStats();
+  REQUIRE(stats.compiled == 5);
+  REQUIRE(stats.hits == 3);
+  REQUIRE(stats.bytesSaved > 0);
+}
+
+TEST_CASE("Share compiled regexps of block ends by back references")
+{
+  auto work_dir = fs::current_path() / "data/type_backref.hrc";
+  auto uwork_dir = UnicodeString(work_dir.c_str());
+  XmlInputSource file1(uwork_dir, nullptr);
+  HrcLibrary lib;
+  lib.loadSource(&file1);
+  auto* type = lib.getFileType(UnicodeString("backref"));
+  REQUIRE(type != nullptr);
+  lib.loadFileType(type);
+
+  auto stats = lib.getRegExpCacheStats();
+  // file name, starts and end of the blocks with quotes, starts of the blocks with back references,
+  // their ends for two sets of bracket names, start and end of the skipped block
+  REQUIRE(stats.compiled == 11);
+  REQUIRE(stats.hits == 2);
+  // the skipped block does not keep its start
+  REQUIRE(stats.cached == 9);
+}
+
+static std::unique_ptr<SchemeNode> createRegexpNode(const char16_t* pattern)
+{
+  UnicodeString upattern(pattern);
+  auto node = std::make_unique<SchemeNodeRegexp>();
+  node->start = std::make_shared<CRegExp>(&upattern);
+  return node;
+}
+
+TEST_CASE("Select scheme nodes by first characters")
+{
+  std::vector<std::unique_ptr<SchemeNode>> nodes;
+  nodes.push_back(createRegexpNode(u"/\\d+/"));
+  nodes.push_back(createRegexpNode(u"/\\s*x/"));
+  nodes.push_back(std::make_unique<SchemeNodeInherit>());
+  nodes.push_back(createRegexpNode(u"/[\u0430-\u044f]+/"));
+  nodes.push_back(createRegexpNode(u"/$/"));
+  SchemePrefilter prefilter;
+  prefilter.build(nodes);
+
+  UnicodeString line(u"1 x\u0436");
+  REQUIRE(prefilter.getCandidates(line, 0) == std::vector<int> {0, 2, 4});
+  REQUIRE(prefilter.getCandidates(line, 1) == std::vector<int> {1, 2, 4});
+  REQUIRE(prefilter.getCandidates(line, 4) == std::vector<int> {2, 4});
+
+  // inherit node without the scheme could not match after links are resolved
+  prefilter.link(nodes);
+  REQUIRE(prefilter.isLinked());
+  REQUIRE(prefilter.getCandidates(line, 0, true) == std::vector<int> {0, 4});
+  REQUIRE(prefilter.getCandidates(line, 0) == std::vector<int> {0, 2, 4});
+}
+
+/** Scheme, which nodes are filled by the test. */
+class TestScheme : public SchemeImpl
+{
+ public:
+  explicit TestScheme(const UnicodeString& name) : SchemeImpl(&name) {}
+  using SchemeImpl::nodes;
+  using SchemeImpl::prefilter;
+};
+
+TEST_CASE("Link scheme nodes again, when the inherited scheme is loaded later")
+{
+  TestScheme parent(UnicodeString("parent"));
+  TestScheme child(UnicodeString("child"));
+  child.nodes.push_back(createRegexpNode(u"/x/"));
+  auto inherit = std::make_unique<SchemeNodeInherit>();
+  auto* inherit_node = inherit.get();
+  inherit_node->schemeName = std::make_unique<UnicodeString>("parent");
+  child.nodes.push_back(std::move(inherit));
+  child.prefilter.build(child.nodes);
+
+  UnicodeString line(u"1xa");
+  // inherit link is not resolved yet
+  child.prefilter.link(child.nodes);
+  REQUIRE(child.prefilter.isLinked());
+  REQUIRE(child.prefilter.getCandidates(line, 1, true) == std::vector<int> {0, 1});
+
+  // inherited scheme is linked, but its nodes are not loaded yet
+  inherit_node->schemeName.reset();
+  inherit_node->scheme = &parent;
+  parent.nodes.push_back(createRegexpNode(u"/\\d+/"));
+  child.prefilter.link(child.nodes);
+  REQUIRE(child.prefilter.getCandidates(line, 1, true) == std::vector<int> {0, 1});
+
+  parent.prefilter.build(parent.nodes);
+  child.prefilter.link(child.nodes);
+  REQUIRE(child.prefilter.getCandidates(line, 0, true) == std::vector<int> {1});
+  REQUIRE(child.prefilter.getCandidates(line, 1, true) == std::vector<int> {0});
+  REQUIRE(child.prefilter.getCandidates(line, 2, true).empty());
+  REQUIRE(child.prefilter.getCandidates(line, 2) == std::vector<int> {1});
+}
+
+TEST_CASE("Find the longest keyword at the position of the line")
+{
+  KeywordList list(5);
+  list.matchCase = true;
+  for (const auto* word : {u"getParam", u"+", u"getPar", u"++", u"GETPARAMETER"}) {
+    list.kwList[list.count++].keyword = std::make_unique<UnicodeString>(word);
+  }
+  list.sortList();
+  list.substrIndex();
+  auto keyword = [&list](int index) { return index == -1 ? UnicodeString() : *list.kwList[index].keyword; };
+
+  UnicodeString line(u"getParameterName +x");
+  const int found = list.findLongest(line, 0, line.length());
+  REQUIRE(keyword(found) == UnicodeString(u"getParam"));
+  REQUIRE(keyword(list.kwList[found].indexOfShorter) == UnicodeString(u"getPar"));
+  REQUIRE(keyword(list.findLongest(line, 0, 7)) == UnicodeString(u"getPar"));
+  REQUIRE(list.findLongest(line, 0, 5) == -1);
+  // the first keyword in the list is the prefix of the next one
+  REQUIRE(keyword(list.findLongest(line, 17, line.length())) == UnicodeString(u"+"));
+
+  KeywordList ignore_case(2);
+  ignore_case.kwList[ignore_case.count++].keyword = std::make_unique<UnicodeString>(u"getPar");
+  ignore_case.kwList[ignore_case.count++].keyword = std::make_unique<UnicodeString>(u"GETPARAMETER");
+  ignore_case.sortList();
+  ignore_case.substrIndex();
+  const int longest = ignore_case.findLongest(line, 0, line.length());
+  REQUIRE(*ignore_case.kwList[longest].keyword == UnicodeString(u"GETPARAMETER"));
+  REQUIRE(*ignore_case.kwList[ignore_case.kwList[longest].indexOfShorter].keyword == UnicodeString(u"getPar"));
+}
+
+static std::unique_ptr<SchemeNode> createKeywordsNode(std::initializer_list<const char16_t*> words, bool match_case,
+                                                      bool symbols = false)
+{
+  auto node = std::make_unique<SchemeNodeKeywords>();
+  node->kwList = std::make_unique<KeywordList>(words.size());
+  node->kwList->matchCase = match_case;
+  for (const auto* word : words) {
+    KeywordInfo& info = node->kwList->kwList[node->kwList->count++];
+    info.keyword = std::make_unique<UnicodeString>(word);
+    info.isSymbol = symbols;
+  }
+  node->kwList->sortList();
+  node->kwList->substrIndex();
+  return node;
+}
+
+TEST_CASE("Find keywords of all keyword nodes of the scheme")
+{
+  std::vector<std::unique_ptr<SchemeNode>> nodes;
+  nodes.push_back(createKeywordsNode({u"If", u"ifdef"}, true));
+  nodes.push_back(createRegexpNode(u"/x/"));
+  nodes.push_back(createKeywordsNode({u"IF", u"ELSE"}, false));
+  nodes.push_back(createKeywordsNode({u"+", u"if+"}, true, true));
+  SchemeKeywords keywords;
+  keywords.build(nodes);
+  REQUIRE(keywords.isBuilt());
+
+  auto find = [&](const char16_t* text) {
+    UnicodeString line(text);
+    const auto match = keywords.find(nodes, line, 0, line.length());
+    if (match.node == -1) {
+      return UnicodeString();
+    }
+    const auto* node = static_cast<const SchemeNodeKeywords*>(nodes[match.node].get());
+    return UnicodeString(match.node == 0 ? u"0:" : match.node == 2 ? u"2:" : u"3:")
+        .append(*node->kwList->kwList[match.keyword].keyword);
+  };
+  // the first node has the priority over the longer keyword of the next node
+  REQUIRE(find(u"If+") == UnicodeString(u"0:If"));
+  // keywords of the node with case are compared with case
+  REQUIRE(find(u"if+") == UnicodeString(u"2:IF"));
+  REQUIRE(find(u"+x") == UnicodeString(u"3:+"));
+  REQUIRE(find(u"ifdef") == UnicodeString(u"0:ifdef"));
+  REQUIRE(find(u"ifdefs") == UnicodeString());
+  REQUIRE(find(u"else ") == UnicodeString(u"2:ELSE"));
+  REQUIRE(find(u"IF_") == UnicodeString());
+
+  std::vector<std::unique_ptr<SchemeNode>> single;
+  single.push_back(createKeywordsNode({u"if"}, true));
+  SchemeKeywords single_keywords;
+  single_keywords.build(single);
+  REQUIRE_FALSE(single_keywords.isBuilt());
+}
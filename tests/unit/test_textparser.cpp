@@ -0,0 +1,861 @@
+#include <catch2/catch.hpp>
+#include <sstream>
+#include "colorer/HrcLibrary.h"
+#include "colorer/LineSource.h"
+#include "colorer/RegionHandler.h"
+#include "colorer/TextParser.h"
+#include "colorer/handlers/LineRegionsCompactSupport.h"
+#include "colorer/utils/FileSystems.h"
+#include "colorer/viewer/StreamLineSource.h"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+class TestLineSource : public LineSource
+{
+ public:
+  std::vector<UnicodeString> lines;
+
+  UnicodeString* getLine(size_t lno) override
+  {
+    return lno < lines.size() ? &lines[lno] : nullptr;
+  }
+};
+
+class TestRegionHandler : public RegionHandler
+{
+ public:
+  int entered = 0;
+  int left = 0;
+  int deepest = 0;
+  std::vector<int> words;
+  std::vector<size_t> wordLines;
+  UnicodeString wordRegion = UnicodeString("nested:word");
+
+  void addRegion(size_t lno, UnicodeString* /*line*/, int sx, int /*ex*/, const Region* region) override
+  {
+    if (region && region->getName().compare(wordRegion) == 0) {
+      words.push_back(sx);
+      wordLines.push_back(lno);
+    }
+  }
+  void enterScheme(size_t /*lno*/, UnicodeString* /*line*/, int /*sx*/, int /*ex*/, const Region* /*region*/,
+                   const Scheme* /*scheme*/) override
+  {
+    entered++;
+    deepest = std::max(deepest, entered - left);
+  }
+  void leaveScheme(size_t /*lno*/, UnicodeString* /*line*/, int /*sx*/, int /*ex*/, const Region* /*region*/,
+                   const Scheme* /*scheme*/) override
+  {
+    left++;
+  }
+};
+
+/** Returns the regions of the lines as the strings "start-end name;".
+*/
+static std::vector<std::string> getLineRegions(LineRegionsCompactSupport& regions, int count)
+{
+  std::vector<std::string> result;
+  for (int i = 0; i < count; i++) {
+    std::string line;
+    for (LineRegion* region = regions.getLineRegions(i); region; region = region->next) {
+      line += std::to_string(region->start) + "-" + std::to_string(region->end) + " ";
+      if (region->region) {
+        line += UStr::to_stdstr(&region->region->getName());
+      }
+      line += ";";
+    }
+    result.push_back(line);
+  }
+  return result;
+}
+
+/** Library of the types from the hrc files of the test data.
+*/
+class TestLibrary
+{
+ public:
+  HrcLibrary lib;
+
+  explicit TestLibrary(std::initializer_list<const char*> files)
+  {
+    for (const auto* file : files) {
+      auto path = fs::current_path() / "data" / file;
+      XmlInputSource source(UnicodeString(path.c_str()), nullptr);
+      lib.loadSource(&source);
+    }
+  }
+
+  FileType* getType(const char* name)
+  {
+    auto* type = lib.getFileType(UnicodeString(name));
+    REQUIRE(type != nullptr);
+    return type;
+  }
+};
+
+/** Sets the type, the lines and the region handler, if it is given, of the parser.
+*/
+static void setupParser(TextParser& parser, FileType* type, LineSource* lines, RegionHandler* handler = nullptr)
+{
+  parser.setFileType(type);
+  parser.setLineSource(lines);
+  if (handler) {
+    parser.setRegionHandler(handler);
+  }
+}
+
+TEST_CASE("Parse deeply nested blocks")
+{
+  TestLibrary lib({"type_nested.hrc"});
+  auto* type = lib.getType("nested");
+
+  const int levels = 1000;
+  TestLineSource lines;
+  UnicodeString line;
+  for (int i = 0; i < levels; i++) {
+    line.append(UnicodeString("("));
+  }
+  line.append(UnicodeString("x"));
+  for (int i = 0; i < levels; i++) {
+    line.append(UnicodeString(")"));
+  }
+  line.append(UnicodeString(" y"));
+  lines.lines.push_back(line);
+  lines.lines.emplace_back("(a");
+  lines.lines.emplace_back("b) z");
+
+  TestRegionHandler handler;
+  TextParser parser;
+  setupParser(parser, type, &lines, &handler);
+
+  SECTION("without cache")
+  {
+    parser.parse(0, 3, TextParser::TextParseMode::TPM_CACHE_OFF);
+  }
+  SECTION("with cache update")
+  {
+    parser.parse(0, 3, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+  }
+  REQUIRE(handler.entered == levels + 1);
+  REQUIRE(handler.left == levels + 1);
+  REQUIRE(handler.deepest == levels);
+  REQUIRE(handler.words == std::vector<int> {levels, 2 * levels + 2, 1, 0, 3});
+}
+
+TEST_CASE("Find the end of block by the back trace of its start")
+{
+  TestLibrary lib({"type_nested.hrc"});
+  auto* type = lib.getType("nested");
+
+  TestLineSource lines;
+  for (const auto* text : {u"x <<END", u"y END1", u"END", u"w <<A", u"A", u"v"}) {
+    lines.lines.emplace_back(text);
+  }
+  const int count = static_cast<int>(lines.lines.size());
+
+  TestRegionHandler handler;
+  TextParser parser;
+  setupParser(parser, type, &lines, &handler);
+  SECTION("without cache")
+  {
+    parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_OFF);
+  }
+  SECTION("with cache update")
+  {
+    parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+  }
+  SECTION("with cache read")
+  {
+    TestRegionHandler update;
+    parser.setRegionHandler(&update);
+    parser.parse(0, 2, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+    parser.parse(2, count - 2, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+    TestRegionHandler read;
+    parser.setRegionHandler(&read);
+    parser.parse(1, count - 1, TextParser::TextParseMode::TPM_CACHE_READ);
+    REQUIRE(read.words == std::vector<int> {0, 2, 0, 0});
+    REQUIRE(read.wordLines == std::vector<size_t> {1, 1, 3, 5});
+    parser.setRegionHandler(&handler);
+    parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_READ);
+  }
+  REQUIRE(handler.words == std::vector<int> {0, 0, 2, 0, 0});
+  REQUIRE(handler.wordLines == std::vector<size_t> {0, 1, 1, 3, 5});
+  REQUIRE(handler.entered == 2);
+  REQUIRE(handler.left == 2);
+}
+
+TEST_CASE("Parse the scheme, which inherits the scheme of the type loaded later")
+{
+  TestLibrary lib({"type_inherit.hrc"});
+  auto* type = lib.getType("inheritchild");
+  auto* parent_type = lib.getType("inheritparent");
+
+  SECTION("with the inheriting type loaded first")
+  {
+    lib.lib.loadFileType(type);
+    lib.lib.loadFileType(parent_type);
+  }
+  SECTION("with the inherited type loaded first")
+  {
+    lib.lib.loadFileType(parent_type);
+    lib.lib.loadFileType(type);
+  }
+
+  TestLineSource lines;
+  lines.lines.emplace_back("12 x 3a");
+  lines.lines.emplace_back(u"\u0436 45");
+  TestRegionHandler handler;
+  handler.wordRegion = UnicodeString("inheritparent:word");
+  TextParser parser;
+  setupParser(parser, type, &lines, &handler);
+  parser.parse(0, 2, TextParser::TextParseMode::TPM_CACHE_OFF);
+  REQUIRE(handler.words == std::vector<int> {0, 5, 2});
+  REQUIRE(handler.wordLines == std::vector<size_t> {0, 0, 1});
+}
+
+TEST_CASE("Skip positions, where no scheme node could start")
+{
+  TestLibrary lib({"type_skip.hrc", "type_nested.hrc"});
+
+  FileType* type = nullptr;
+  TestLineSource lines;
+  TestRegionHandler handler;
+  std::vector<int> words;
+  std::vector<size_t> word_lines;
+  SECTION("with the end of the parent block inside of the skipped characters")
+  {
+    type = lib.getType("skip");
+    handler.wordRegion = UnicodeString("skip:word");
+    for (const auto* line : {"[a1bcxyd2 z", "{ab1cz3 x", "[abc", "1 xy"}) {
+      lines.lines.emplace_back(line);
+    }
+    words = {2, 8, 3, 6, 0};
+    word_lines = {0, 0, 1, 1, 3};
+  }
+  SECTION("with the inherited scheme under the virtual substitution")
+  {
+    type = lib.getType("nestedvirtual");
+    handler.wordRegion = UnicodeString("nestedvirtual:word");
+    lines.lines.emplace_back("ab 12 (cd 34) [ef 5 (g6 h)] i7");
+    // numbers are substituted for words out of the block
+    words = {3, 10, 15, 21, 24, 29};
+    word_lines = {0, 0, 0, 0, 0, 0};
+  }
+  SECTION("with the first characters, which are not latin")
+  {
+    type = lib.getType("skip");
+    handler.wordRegion = UnicodeString("skip:word");
+    lines.lines.emplace_back(u"\u03c9\u03c9 \u0436\u0443\u043a \u00e9a \u0436\u0031 \U0001f600\u0436");
+    lines.lines.emplace_back(u"\u03c9\u00e9 \u00e8\u0436");
+    words = {3, 7, 10, 15, 1, 4};
+    word_lines = {0, 0, 0, 0, 1, 1};
+  }
+  const int count = static_cast<int>(lines.lines.size());
+
+  TextParser parser;
+  setupParser(parser, type, &lines, &handler);
+  parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_OFF);
+  REQUIRE(handler.words == words);
+  REQUIRE(handler.wordLines == word_lines);
+
+  LineRegionsCompactSupport skip_regions;
+  skip_regions.resize(count);
+  parser.setRegionHandler(&skip_regions);
+  parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_OFF);
+
+  LineRegionsCompactSupport regions;
+  regions.resize(count);
+  parser.setRegionHandler(&regions);
+  parser.setSkipNoMatch(false);
+  parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_OFF);
+  REQUIRE(getLineRegions(skip_regions, count) == getLineRegions(regions, count));
+}
+
+TEST_CASE("Reparse modified lines until the parser state converges")
+{
+  TestLibrary lib({"type_nested.hrc"});
+  auto* type = lib.getType("nested");
+
+  TestLineSource lines;
+  for (const auto* text : {u"a (b", u"c", u"d) e", u"f", u"(g", u"h)"}) {
+    lines.lines.emplace_back(text);
+  }
+  const int count = static_cast<int>(lines.lines.size());
+
+  TestRegionHandler handler;
+  TextParser parser;
+  setupParser(parser, type, &lines, &handler);
+  parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+
+  int damaged_end = -1;
+  TestRegionHandler changed;
+  SECTION("with the same block structure")
+  {
+    lines.lines[1] = UnicodeString("c1 c2");
+    parser.setRegionHandler(&changed);
+    REQUIRE(parser.reparseLines(1, 1, count - 1, &damaged_end) == count - 1);
+    REQUIRE(damaged_end == 1);
+    REQUIRE(changed.words == std::vector<int> {0, 3});
+  }
+  SECTION("with removed block")
+  {
+    lines.lines[0] = UnicodeString("a b");
+    parser.setRegionHandler(&changed);
+    REQUIRE(parser.reparseLines(0, 0, count, &damaged_end) == count - 1);
+    REQUIRE(damaged_end == 2);
+    REQUIRE(changed.words == std::vector<int> {0, 2, 0, 0, 3});
+    REQUIRE(changed.wordLines == std::vector<size_t> {0, 0, 1, 2, 2});
+  }
+  SECTION("with block, which is not closed")
+  {
+    lines.lines[2] = UnicodeString("d e");
+    parser.setRegionHandler(&changed);
+    REQUIRE(parser.reparseLines(2, 2, count - 2, &damaged_end) == count - 1);
+    REQUIRE(damaged_end == count - 1);
+  }
+
+  // cache after the reparse gives the same regions, as the new parse
+  TestRegionHandler cached;
+  parser.setRegionHandler(&cached);
+  parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_READ);
+  TestRegionHandler fresh;
+  TextParser fresh_parser;
+  setupParser(fresh_parser, type, &lines, &fresh);
+  fresh_parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_OFF);
+  REQUIRE(cached.words == fresh.words);
+  REQUIRE(cached.wordLines == fresh.wordLines);
+  REQUIRE(cached.entered == fresh.entered);
+}
+
+TEST_CASE("Resume parse from cache checkpoints")
+{
+  TestLibrary lib({"type_nested.hrc"});
+  auto* type = lib.getType("nested");
+
+  TestLineSource lines;
+  for (int i = 0; i < 50; i++) {
+    lines.lines.emplace_back("(a) (b");
+    lines.lines.emplace_back("c (d");
+    lines.lines.emplace_back("e)) f");
+  }
+  const int count = static_cast<int>(lines.lines.size());
+
+  TestRegionHandler handler;
+  TestRegionHandler plain_handler;
+  TextParser parser;
+  setupParser(parser, type, &lines, &handler);
+  parser.setCheckpointInterval(4);
+  TextParser plain_parser;
+  setupParser(plain_parser, type, &lines, &plain_handler);
+  plain_parser.setCheckpointInterval(0);
+
+  parser.parse(0, count / 2, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+  plain_parser.parse(0, count / 2, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+  parser.parse(count / 2, count - count / 2, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+  plain_parser.parse(count / 2, count - count / 2, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+
+  // line 'c (d' is changed to close the block, then lines are reparsed after it
+  lines.lines[70] = UnicodeString("c d)");
+  parser.parse(70, count - 70, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+  plain_parser.parse(70, count - 70, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+
+  for (int from : {149, 3, 70, 71, 8, 9, 100, 0, 65}) {
+    TestRegionHandler read;
+    TestRegionHandler plain_read;
+    parser.setRegionHandler(&read);
+    plain_parser.setRegionHandler(&plain_read);
+    const int num = std::min(5, count - from);
+    parser.parse(from, num, TextParser::TextParseMode::TPM_CACHE_READ);
+    plain_parser.parse(from, num, TextParser::TextParseMode::TPM_CACHE_READ);
+    INFO("from " << from);
+    REQUIRE(read.words == plain_read.words);
+    REQUIRE(read.wordLines == plain_read.wordLines);
+    REQUIRE(read.entered == plain_read.entered);
+    REQUIRE(read.left == plain_read.left);
+  }
+}
+
+TEST_CASE("Continue append parse with the kept parser state")
+{
+  TestLibrary lib({"type_nested.hrc"});
+  auto* type = lib.getType("nested");
+
+  std::vector<UnicodeString> text;
+  for (int i = 0; i < 30; i++) {
+    for (const auto* line : {u"a (b", u"x <<END", u"c (d", u"END", u"e) f", u"g)"}) {
+      text.emplace_back(line);
+    }
+  }
+  const int count = static_cast<int>(text.size());
+
+  // lines are added to the sources by parts, as they are added to the growing text
+  TestLineSource lines;
+  TestLineSource update_lines;
+  TextParser parser;
+  setupParser(parser, type, &lines);
+  TextParser update_parser;
+  setupParser(update_parser, type, &update_lines);
+
+  int parsed = 0;
+  for (int part = 1; parsed < count; part++) {
+    const int num = std::min(part % 7 + 1, count - parsed);
+    for (int i = parsed; i < parsed + num; i++) {
+      lines.lines.push_back(text[i]);
+      update_lines.lines.push_back(text[i]);
+    }
+    TestRegionHandler handler;
+    TestRegionHandler update_handler;
+    parser.setRegionHandler(&handler);
+    update_parser.setRegionHandler(&update_handler);
+    REQUIRE(parser.parse(parsed, num, TextParser::TextParseMode::TPM_CACHE_APPEND) == parsed + num - 1);
+    update_parser.parse(parsed, num, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+    INFO("lines " << parsed << "-" << parsed + num);
+    REQUIRE(handler.words == update_handler.words);
+    REQUIRE(handler.wordLines == update_handler.wordLines);
+    REQUIRE(handler.entered == update_handler.entered);
+    REQUIRE(handler.left == update_handler.left);
+    parsed += num;
+
+    // the read parse drops the kept state, the next append parse searches the cache
+    if (part % 5 == 0) {
+      TestRegionHandler read;
+      parser.setRegionHandler(&read);
+      parser.parse(parsed / 2, parsed - parsed / 2, TextParser::TextParseMode::TPM_CACHE_READ);
+    }
+  }
+
+  TestRegionHandler read;
+  TestRegionHandler update_read;
+  parser.setRegionHandler(&read);
+  update_parser.setRegionHandler(&update_read);
+  parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_READ);
+  update_parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_READ);
+  REQUIRE(read.words == update_read.words);
+  REQUIRE(read.wordLines == update_read.wordLines);
+  REQUIRE(read.entered == update_read.entered);
+  REQUIRE(read.left == update_read.left);
+}
+
+TEST_CASE("Continue parse, which is stopped by the budget")
+{
+  TestLibrary lib({"type_nested.hrc"});
+  auto* type = lib.getType("nested");
+
+  TestLineSource lines;
+  for (int i = 0; i < 30; i++) {
+    for (const auto* line : {u"a (b", u"x <<END", u"c (d", u"END", u"e) f", u"g)"}) {
+      lines.lines.emplace_back(line);
+    }
+  }
+  const int count = static_cast<int>(lines.lines.size());
+
+  TestRegionHandler update_handler;
+  TextParser update_parser;
+  setupParser(update_parser, type, &lines, &update_handler);
+  update_parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+
+  TestRegionHandler handler;
+  TextParser parser;
+  setupParser(parser, type, &lines, &handler);
+  ParseBudget budget;
+  budget.lines = 7;
+  int parsed = 0;
+  for (int part = 1; parsed < count; part++) {
+    const int next = parser.parse(parsed, count - parsed, TextParser::TextParseMode::TPM_CACHE_UPDATE, budget);
+    REQUIRE(next == std::min(parsed + budget.lines, count));
+    parsed = next;
+
+    // the read parse drops the kept state, the next parse searches the cache
+    if (part % 5 == 0) {
+      TestRegionHandler read;
+      parser.setRegionHandler(&read);
+      parser.parse(parsed / 2, parsed - parsed / 2, TextParser::TextParseMode::TPM_CACHE_READ);
+      parser.setRegionHandler(&handler);
+    }
+  }
+  REQUIRE(handler.words == update_handler.words);
+  REQUIRE(handler.wordLines == update_handler.wordLines);
+
+  // the expired deadline stops the parse after the first line
+  budget.lines = 0;
+  budget.deadline = std::chrono::steady_clock::now();
+  REQUIRE(parser.parse(10, 20, TextParser::TextParseMode::TPM_CACHE_UPDATE, budget) == 11);
+  REQUIRE(parser.parse(11, 19, TextParser::TextParseMode::TPM_CACHE_UPDATE) == 29);
+
+  TestRegionHandler read;
+  TestRegionHandler update_read;
+  parser.setRegionHandler(&read);
+  update_parser.setRegionHandler(&update_read);
+  parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_READ);
+  update_parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_READ);
+  REQUIRE(read.words == update_read.words);
+  REQUIRE(read.wordLines == update_read.wordLines);
+  REQUIRE(read.entered == update_read.entered);
+  REQUIRE(read.left == update_read.left);
+}
+
+TEST_CASE("Parse the stream by parts with the kept parser state")
+{
+  TestLibrary lib({"type_nested.hrc"});
+  auto* type = lib.getType("nested");
+
+  TestLineSource lines;
+  FILE* stream = tmpfile();
+  REQUIRE(stream != nullptr);
+  for (int i = 0; i < 30; i++) {
+    for (const auto* line : {"a (b", "x <<END", "c (d", "END", "e) f", "g)"}) {
+      lines.lines.emplace_back(line);
+      fprintf(stream, "%s\r\n", line);
+    }
+  }
+  // the text is ended with the empty line
+  lines.lines.emplace_back();
+  rewind(stream);
+  const int count = static_cast<int>(lines.lines.size());
+
+  TestRegionHandler full_handler;
+  TextParser full_parser;
+  setupParser(full_parser, type, &lines, &full_handler);
+  full_parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_OFF);
+
+  StreamLineSource source(stream, false);
+  TestRegionHandler handler;
+  TextParser parser;
+  setupParser(parser, type, &source, &handler);
+  ParseBudget budget;
+  budget.lines = 5;
+  size_t from = 0;
+  size_t part;
+  while ((part = source.readLines(budget.lines)) != 0) {
+    REQUIRE(*source.getLine(from) == lines.lines[from]);
+    if (source.isEnd()) {
+      parser.parse(static_cast<int>(from), static_cast<int>(part), TextParser::TextParseMode::TPM_CACHE_OFF);
+    }
+    else {
+      REQUIRE(parser.parse(static_cast<int>(from), static_cast<int>(part) + 1,
+                           TextParser::TextParseMode::TPM_CACHE_OFF, budget) == static_cast<int>(from + part));
+    }
+    source.releaseLines(from + part);
+    from += part;
+    REQUIRE(source.getLine(from - 1) == nullptr);
+  }
+  fclose(stream);
+
+  REQUIRE(from == lines.lines.size());
+  REQUIRE(handler.words == full_handler.words);
+  REQUIRE(handler.wordLines == full_handler.wordLines);
+}
+
+TEST_CASE("Parse chunks of the text on several threads")
+{
+  TestLibrary lib({"type_nested.hrc"});
+
+  // the block, which is opened in the middle of the text, is not closed,
+  // so the chunks after it are started in other state
+  TestLineSource lines;
+  UnicodeString word_region;
+  FileType* type;
+  SECTION("with back traces")
+  {
+    type = lib.getType("nested");
+    word_region = UnicodeString("nested:word");
+    for (int i = 0; i < 700; i++) {
+      for (const auto* line : {"a (b", "x <<END", "c (d", "END", "e) f", "g)"}) {
+        lines.lines.emplace_back(line);
+      }
+      if (i == 350) {
+        lines.lines.emplace_back("y <<EOT");
+      }
+    }
+  }
+  SECTION("with virtual schemes")
+  {
+    type = lib.getType("nestedvirtual");
+    word_region = UnicodeString("nestedvirtual:word");
+    for (int i = 0; i < 700; i++) {
+      for (const auto* line : {"a1 [b2", "(c3", "d4) e5", "f6]", "(g7", "h8)"}) {
+        lines.lines.emplace_back(line);
+      }
+      if (i == 350) {
+        lines.lines.emplace_back("[");
+      }
+    }
+  }
+  const int count = static_cast<int>(lines.lines.size());
+
+  TestRegionHandler full_handler;
+  full_handler.wordRegion = word_region;
+  TextParser full_parser;
+  setupParser(full_parser, type, &lines, &full_handler);
+  const int full_end = full_parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_OFF);
+
+  TestRegionHandler handler;
+  handler.wordRegion = word_region;
+  TextParser parser;
+  setupParser(parser, type, &lines, &handler);
+  REQUIRE(parser.parseParallel(0, count, 3) == full_end);
+
+  REQUIRE(!handler.words.empty());
+  REQUIRE(handler.words == full_handler.words);
+  REQUIRE(handler.wordLines == full_handler.wordLines);
+  REQUIRE(handler.entered == full_handler.entered);
+  REQUIRE(handler.left == full_handler.left);
+}
+
+TEST_CASE("Pass the regions of the kept blocks before the line of the continued parse")
+{
+  TestLibrary lib({"type_nested.hrc"});
+  auto* type = lib.getType("nestedtext");
+
+  // the block without region is nested into the block with region at the end of the line
+  TestLineSource lines;
+  for (const auto* line : {"a <<END", "b (", "c (", "d", "e ) )", "END", "f"}) {
+    lines.lines.emplace_back(line);
+  }
+  const int count = static_cast<int>(lines.lines.size());
+
+  LineRegionsCompactSupport full_regions;
+  full_regions.resize(count);
+  TextParser full_parser;
+  setupParser(full_parser, type, &lines, &full_regions);
+  full_parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_OFF);
+
+  // each line is parsed by the separate parse, which continues the kept state
+  LineRegionsCompactSupport regions;
+  regions.resize(count);
+  TextParser parser;
+  setupParser(parser, type, &lines, &regions);
+  ParseBudget budget;
+  budget.lines = 1;
+  for (int i = 0; i + 1 < count; i++) {
+    REQUIRE(parser.parse(i, count - i, TextParser::TextParseMode::TPM_CACHE_OFF, budget) == i + 1);
+  }
+  parser.parse(count - 1, 1, TextParser::TextParseMode::TPM_CACHE_OFF);
+
+  REQUIRE(getLineRegions(regions, count) == getLineRegions(full_regions, count));
+}
+
+#ifndef _WIN32
+TEST_CASE("Read the lines, which are received from the pipe, without waiting for the next ones")
+{
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  FILE* stream = fdopen(fds[0], "r");
+  REQUIRE(stream != nullptr);
+  StreamLineSource source(stream, false);
+
+  // the last line is not ended, and the pipe is kept open
+  const std::string text = "a\r\nb\rc\nd";
+  REQUIRE(write(fds[1], text.data(), text.size()) == static_cast<ssize_t>(text.size()));
+  REQUIRE(source.readLines(100) == 3);
+  REQUIRE(*source.getLine(0) == UnicodeString("a"));
+  REQUIRE(*source.getLine(2) == UnicodeString("c"));
+  REQUIRE(!source.isEnd());
+
+  REQUIRE(write(fds[1], "e\n", 2) == 2);
+  close(fds[1]);
+  source.releaseLines(3);
+  REQUIRE(source.readLines(100) == 1);
+  REQUIRE(*source.getLine(3) == UnicodeString("de"));
+  // the empty line after the last line separator is found at the end of the stream
+  source.releaseLines(4);
+  REQUIRE(source.readLines(100) == 1);
+  REQUIRE(source.getLine(4)->isEmpty());
+  REQUIRE(source.isEnd());
+  fclose(stream);
+}
+#endif
+
+TEST_CASE("Replay regions of repeated lines from the line memo")
+{
+  TestLibrary lib({"type_nested.hrc"});
+
+  // the same lines are parsed in blocks with different back traces and virtual schemes
+  TestLineSource lines;
+  UnicodeString word_region;
+  FileType* type;
+  SECTION("with back traces")
+  {
+    type = lib.getType("nested");
+    word_region = UnicodeString("nested:word");
+    for (int i = 0; i < 20; i++) {
+      for (const auto* text : {u"a (b) c", u"x <<A", u"a (b) c", u"B", u"A", u"y <<B", u"A", u"B", u"(d", u"a (b) c", u"e)"}) {
+        lines.lines.emplace_back(text);
+      }
+    }
+  }
+  SECTION("with virtual schemes")
+  {
+    type = lib.getType("nestedvirtual");
+    word_region = UnicodeString("nestedvirtual:word");
+    for (int i = 0; i < 20; i++) {
+      for (const auto* text : {u"a1 2b", u"(", u"a1 2b", u")", u"[(", u"a1 2b", u")]", u"[", u"a1 2b", u"]"}) {
+        lines.lines.emplace_back(text);
+      }
+    }
+  }
+  const int count = static_cast<int>(lines.lines.size());
+
+  TestRegionHandler plain_handler;
+  plain_handler.wordRegion = word_region;
+  TextParser plain_parser;
+  setupParser(plain_parser, type, &lines, &plain_handler);
+  plain_parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_OFF);
+
+  std::vector<size_t> hits;
+  for (const size_t memo_size : {2, 100}) {
+    TestRegionHandler handler;
+    handler.wordRegion = word_region;
+    TextParser parser;
+    setupParser(parser, type, &lines, &handler);
+    parser.setLineMemoSize(memo_size);
+    parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_OFF);
+
+    INFO("memo size " << memo_size);
+    REQUIRE(handler.words == plain_handler.words);
+    REQUIRE(handler.wordLines == plain_handler.wordLines);
+    REQUIRE(handler.entered == plain_handler.entered);
+    REQUIRE(handler.left == plain_handler.left);
+    const LineMemoStats stats = parser.getLineMemoStats();
+    REQUIRE(stats.size <= memo_size);
+    hits.push_back(stats.hits);
+  }
+  // the small memo loses most of the lines before they are repeated
+  REQUIRE(hits[1] > hits[0]);
+  REQUIRE(plain_parser.getLineMemoStats().hits == 0);
+}
+
+TEST_CASE("Save and load parse cache")
+{
+  TestLibrary lib({"type_nested.hrc"});
+  auto* type = lib.getType("nestedvirtual");
+  auto* other_type = lib.getType("nested");
+
+  TestLineSource lines;
+  for (int i = 0; i < 20; i++) {
+    lines.lines.emplace_back("a1 (b2 (c3");
+    lines.lines.emplace_back("d4) e5) [f6 (g7");
+    lines.lines.emplace_back("h8) i9] j10");
+  }
+  const int count = static_cast<int>(lines.lines.size());
+
+  TestRegionHandler handler;
+  handler.wordRegion = UnicodeString("nestedvirtual:word");
+  TextParser parser;
+  setupParser(parser, type, &lines, &handler);
+  parser.parse(0, count - 10, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+
+  std::stringstream stream;
+  REQUIRE(parser.saveCache(stream));
+  const std::string saved = stream.str();
+
+  TestRegionHandler loaded;
+  loaded.wordRegion = handler.wordRegion;
+  TextParser load_parser;
+  setupParser(load_parser, type, &lines, &loaded);
+
+  SECTION("with the same text and schemes")
+  {
+    std::stringstream in(saved);
+    REQUIRE(load_parser.loadCache(in) == count - 10);
+    load_parser.parse(count - 10, 10, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+    parser.parse(count - 10, 10, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+    for (int from : {count - 5, 31, 0, 4, 44}) {
+      TestRegionHandler read;
+      TestRegionHandler load_read;
+      read.wordRegion = load_read.wordRegion = handler.wordRegion;
+      parser.setRegionHandler(&read);
+      load_parser.setRegionHandler(&load_read);
+      parser.parse(from, 5, TextParser::TextParseMode::TPM_CACHE_READ);
+      load_parser.parse(from, 5, TextParser::TextParseMode::TPM_CACHE_READ);
+      INFO("from " << from);
+      REQUIRE_FALSE(read.words.empty());
+      REQUIRE(load_read.words == read.words);
+      REQUIRE(load_read.wordLines == read.wordLines);
+      REQUIRE(load_read.entered == read.entered);
+      REQUIRE(load_read.left == read.left);
+    }
+  }
+  SECTION("with changed text")
+  {
+    lines.lines[7] = UnicodeString("d4 e5) [f6 (g7");
+    std::stringstream in(saved);
+    REQUIRE(load_parser.loadCache(in) == 0);
+  }
+  SECTION("with other schemes")
+  {
+    load_parser.setFileType(other_type);
+    std::stringstream in(saved);
+    REQUIRE(load_parser.loadCache(in) == 0);
+  }
+  SECTION("with broken stream")
+  {
+    std::stringstream in(saved.substr(0, saved.size() - 3));
+    REQUIRE(load_parser.loadCache(in) == 0);
+  }
+}
+
+TEST_CASE("Reject parse cache entries out of their lines")
+{
+  TestLibrary lib({"type_nested.hrc"});
+  auto* type = lib.getType("nested");
+
+  // the heredoc block with the back line is the last entry, inside of the paren block
+  TestLineSource lines;
+  lines.lines = {UnicodeString("(a"), UnicodeString("<<EOF"), UnicodeString("b"), UnicodeString("EOF"),
+                 UnicodeString("c)"), UnicodeString("d")};
+  const int count = static_cast<int>(lines.lines.size());
+
+  TestRegionHandler handler;
+  TextParser parser;
+  setupParser(parser, type, &lines, &handler);
+  parser.parse(0, count, TextParser::TextParseMode::TPM_CACHE_UPDATE);
+  std::stringstream stream;
+  REQUIRE(parser.saveCache(stream));
+  std::string saved = stream.str();
+
+  // parent, start and end lines of the heredoc block, the lines after the starts of the blocks are stored
+  const int32_t heredoc[] = {0, 2, 3};
+  const auto heredoc_pos = saved.find(std::string(reinterpret_cast<const char*>(heredoc), sizeof(heredoc)));
+  REQUIRE(heredoc_pos != std::string::npos);
+  const auto patch = [&saved](size_t pos, int32_t value) {
+    saved.replace(pos, sizeof(value), reinterpret_cast<const char*>(&value), sizeof(value));
+  };
+  // the back line "<<EOF", its length and the count of named brackets are written after the end of bracket 2
+  const size_t last_end_pos = saved.size() - 5 * sizeof(uint16_t) - 2 * sizeof(int32_t) - sizeof(int32_t);
+
+  TextParser load_parser;
+  setupParser(load_parser, type, &lines, &handler);
+
+  SECTION("with valid entries")
+  {
+    std::stringstream in(saved);
+    REQUIRE(load_parser.loadCache(in) == count);
+  }
+  SECTION("with the match after the end of the back line")
+  {
+    patch(last_end_pos, 6);
+    std::stringstream in(saved);
+    REQUIRE(load_parser.loadCache(in) == 0);
+  }
+  SECTION("with the match before the start of the back line")
+  {
+    patch(last_end_pos - sizeof(int32_t), -2);
+    std::stringstream in(saved);
+    REQUIRE(load_parser.loadCache(in) == 0);
+  }
+  SECTION("with the start line after the end line")
+  {
+    patch(heredoc_pos + sizeof(int32_t), 4);
+    std::stringstream in(saved);
+    REQUIRE(load_parser.loadCache(in) == 0);
+  }
+  SECTION("with the lines out of the parent entry")
+  {
+    patch(heredoc_pos + 2 * sizeof(int32_t), count);
+    std::stringstream in(saved);
+    REQUIRE(load_parser.loadCache(in) == 0);
+  }
+}
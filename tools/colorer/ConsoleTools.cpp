@@ -2,15 +2,21 @@
 #include <colorer/base/BaseNames.h>
 #include <colorer/cregexp/cregexp.h>
 #include <colorer/editor/BaseEditor.h>
+#include <colorer/handlers/LineRegionsCompactSupport.h>
 #include <colorer/io/FileWriter.h>
 #include <colorer/io/InputSource.h>
 #include <colorer/viewer/ParsedLineWriter.h>
+#include <colorer/viewer/StreamLineSource.h>
 #include <colorer/viewer/TextConsoleViewer.h>
+#include <algorithm>
 #include <cstring>
 #include <ctime>
 #include <memory>
 #include "colorer/xml/XmlReader.h"
 
+// maximum number of lines, which are parsed and written at once, when the text is read from the stream
+static const size_t STREAM_PART_LINES = 1000;
+
 void ConsoleTools::setCopyrightHeader(bool use)
 {
   copyrightHeader = use;
@@ -368,12 +374,36 @@ void ConsoleTools::forward()
   delete fis;
 }
 
+static void writeParsedLine(Writer* commonWriter, Writer* escapedWriter, bool useTokens, bool useMarkup,
+                            std::unordered_map<UnicodeString, UnicodeString*>* docLinkHash, UnicodeString* line,
+                            LineRegion* lineRegions)
+{
+  if (useTokens) {
+    ParsedLineWriter::tokenWrite(commonWriter, escapedWriter, docLinkHash, line, lineRegions);
+  }
+  else if (useMarkup) {
+    ParsedLineWriter::markupWrite(commonWriter, escapedWriter, docLinkHash, line, lineRegions);
+  }
+  else {
+    ParsedLineWriter::htmlRGBWrite(commonWriter, escapedWriter, docLinkHash, line, lineRegions);
+  }
+  commonWriter->write("\n");
+}
+
 void ConsoleTools::genOutput(bool useTokens)
 {
   try {
+    // Text from the standard input is parsed by parts, while it is read.
+    // Line numbers need the count of lines, so the whole text is read for them.
+    bool streamInput = inputFileName == nullptr && !lineNumbers;
     // Source file text lines store.
     TextLinesStore textLinesStore;
-    textLinesStore.loadFile(inputFileName.get(), true);
+    StreamLineSource streamSource(stdin, true);
+    LineSource* lineSource = &streamSource;
+    if (!streamInput) {
+      textLinesStore.loadFile(inputFileName.get(), true);
+      lineSource = &textLinesStore;
+    }
     // parsers factory
     ParserFactory pf;
     pf.loadCatalog(catalogPath.get());
@@ -391,20 +421,13 @@ void ConsoleTools::genOutput(bool useTokens)
         mapper = pf.createTextMapper(hrdName.get());
       }
     }
-    // Base editor to make primary parse
-    BaseEditor baseEditor(&pf, &textLinesStore);
-    // Using compact regions
-    baseEditor.setRegionCompact(true);
-    baseEditor.setRegionMapper(mapper.get());
-    baseEditor.lineCountEvent((int) textLinesStore.getLineCount());
     // Choosing file type
-    FileType* type = selectType(&hrcLibrary, &textLinesStore);
-    baseEditor.setFileType(type);
+    FileType* type = selectType(&hrcLibrary, lineSource);
 
     //  writing result into HTML colored stream...
     const RegionDefine* rd = nullptr;
     if (mapper != nullptr) {
-      rd = baseEditor.rd_def_Text;
+      rd = mapper->getRegionDefine("def:Text");
     }
 
     Writer* escapedWriter;
@@ -448,37 +471,75 @@ void ConsoleTools::genOutput(bool useTokens)
       commonWriter->write("'\n\n");
     }
 
-    int lni = 0;
-    int lwidth = 1;
-    int lncount = (int) textLinesStore.getLineCount();
-    for (lni = lncount / 10; lni > 0; lni = lni / 10) {
-      lwidth++;
-    }
-    for (int i = 0; i < lncount; i++) {
-      if (lineNumbers) {
-        int iwidth = 1;
-        for (lni = i / 10; lni > 0; lni = lni / 10) {
-          iwidth++;
+    if (streamInput) {
+      // Only regions of the current part are kept, the parser keeps
+      // its state at the end of the part and continues from it.
+      LineRegionsCompactSupport lineRegions;
+      lineRegions.resize(STREAM_PART_LINES);
+      lineRegions.setRegionMapper(mapper.get());
+      UnicodeString def_special = UnicodeString("def:Special");
+      lineRegions.setSpecialRegion(hrcLibrary.getRegion(&def_special));
+      auto textParser = pf.createTextParser();
+      textParser->setRegionHandler(&lineRegions);
+      textParser->setLineSource(&streamSource);
+      hrcLibrary.loadFileType(type);
+      textParser->setFileType(type);
+      ParseBudget budget;
+
+      size_t from = 0;
+      size_t kept;
+      // the part is the lines, which are received already, they are written at once
+      while ((kept = streamSource.readLines(STREAM_PART_LINES)) != 0) {
+        // the text with other encoding is read at once
+        size_t count = std::min(kept, STREAM_PART_LINES);
+        lineRegions.setFirstLine(from);
+        if (streamSource.isEnd() && count == kept) {
+          textParser->parse((int) from, (int) count, TextParser::TextParseMode::TPM_CACHE_OFF);
         }
-        for (lni = iwidth; lni < lwidth; lni++) {
-          commonWriter->write(0x0020);
+        else {
+          // the part is ended by the budget, so the parse is suspended and not finished
+          budget.lines = (int) count;
+          textParser->parse((int) from, (int) count + 1, TextParser::TextParseMode::TPM_CACHE_OFF, budget);
         }
-        commonWriter->write(UStr::to_unistr(i));
-        commonWriter->write(": ");
-      }
-      if (useTokens) {
-        ParsedLineWriter::tokenWrite(commonWriter, escapedWriter, &docLinkHash, textLinesStore.getLine(i),
-                                     baseEditor.getLineRegions(i));
+        for (size_t i = from; i < from + count; i++) {
+          writeParsedLine(commonWriter, escapedWriter, useTokens, useMarkup, &docLinkHash, streamSource.getLine(i),
+                          lineRegions.getLineRegions(i));
+        }
+        commonWriter->flush();
+        streamSource.releaseLines(from + count);
+        from += count;
       }
-      else if (useMarkup) {
-        ParsedLineWriter::markupWrite(commonWriter, escapedWriter, &docLinkHash, textLinesStore.getLine(i),
-                                      baseEditor.getLineRegions(i));
+    }
+    else {
+      // Base editor to make primary parse
+      BaseEditor baseEditor(&pf, &textLinesStore);
+      // Using compact regions
+      baseEditor.setRegionCompact(true);
+      baseEditor.setRegionMapper(mapper.get());
+      baseEditor.lineCountEvent((int) textLinesStore.getLineCount());
+      baseEditor.setFileType(type);
+
+      int lni = 0;
+      int lwidth = 1;
+      int lncount = (int) textLinesStore.getLineCount();
+      for (lni = lncount / 10; lni > 0; lni = lni / 10) {
+        lwidth++;
       }
-      else {
-        ParsedLineWriter::htmlRGBWrite(commonWriter, escapedWriter, &docLinkHash, textLinesStore.getLine(i),
-                                       baseEditor.getLineRegions(i));
+      for (int i = 0; i < lncount; i++) {
+        if (lineNumbers) {
+          int iwidth = 1;
+          for (lni = i / 10; lni > 0; lni = lni / 10) {
+            iwidth++;
+          }
+          for (lni = iwidth; lni < lwidth; lni++) {
+            commonWriter->write(0x0020);
+          }
+          commonWriter->write(UStr::to_unistr(i));
+          commonWriter->write(": ");
+        }
+        writeParsedLine(commonWriter, escapedWriter, useTokens, useMarkup, &docLinkHash, textLinesStore.getLine(i),
+                        baseEditor.getLineRegions(i));
       }
-      commonWriter->write("\n");
     }
 
     if (htmlWrapping && useTokens) {